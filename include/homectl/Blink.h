@@ -10,10 +10,22 @@
  * the intensity of the LED.
  */
 class Blink {
+ public:
+  /**
+   * How much the PWM value changes per loop(). Must divide 255.
+   */
+  static constexpr uint8_t STEP = 5;
+  /**
+   * Time between loop() calls, so a whole blink takes 2 * 255 / STEP * STEP_MS
+   * (about 2 seconds).
+   */
+  static constexpr unsigned long STEP_MS = 20;
+
+ private:
   bool enabled_ = true;
   uint8_t const pin_;
-  uint8_t increment_ = 1;
-  uint8_t value_ = 255;
+  uint8_t increment_ = STEP;
+  uint8_t value_ = 0;
 
  public:
   /**
@@ -1,8 +1,41 @@
 #pragma once
 
 #include <Arduino.h>
+#include <math.h>
 
 #include "homectl/Callback.h"
+#include "homectl/Event.h"
+#include "homectl/FrameCodec.h"
+#include "homectl/Queue.h"
+#include "homectl/RecursiveLeastSquares.h"
+
+/**
+ * Framing of the MH-Z19B's UART protocol: 9-byte frames starting with 0xFF,
+ * ending with the negated sum of the bytes in between.
+ */
+struct MHZ19BFraming : FramingDefaults {
+  static constexpr uint32_t SYNC = 0xFF;
+  static constexpr int SYNC_LEN = 1;
+  static constexpr int HEADER_LEN = 1;
+  static constexpr int MAX_LEN = 9;
+  static constexpr int CHECKSUM_LEN = 1;
+
+  static constexpr int frameLength(uint8_t const *header) { return MAX_LEN; }
+  static constexpr uint8_t checksum(uint8_t const *frame, int len) {
+    return uint8_t(-byteSum(frame, 1, len - 1));
+  }
+
+  /**
+   * Offsets of the fields in a response.
+   */
+  enum Field {
+    COMMAND = 1,
+    PPM = 2,
+    TEMPERATURE = 4,
+    STATUS = 5,
+    UNKNOWN = 6,
+  };
+};
 
 /**
  * MH-Z19b sensor interface using a user-supplied UART stream.
@@ -49,9 +82,43 @@ class CO2 {
   };
 
   /**
-   * Set up communication at baud 9600 with the sensor.
+   * How a command sent to the sensor ended.
+   */
+  enum CommandOutcome {
+    /**
+     * The sensor responded to the command.
+     */
+    COMMAND_ACKED,
+    /**
+     * The sensor didn't respond to any of the MAX_ATTEMPTS attempts.
+     */
+    COMMAND_TIMED_OUT,
+  };
+
+  struct CommandResult {
+    /**
+     * The command byte, e.g. 0x86 for requestReading().
+     */
+    byte command;
+    CommandOutcome outcome;
+    /**
+     * Number of times the command was sent.
+     */
+    uint8_t attempts;
+  };
+
+  /**
+   * Each command is sent up to this many times. The sensor gets
+   * COMMAND_TIMEOUT_MS to respond to the first attempt, and twice as long as
+   * the previous attempt after that.
+   */
+  static constexpr int MAX_ATTEMPTS = 3;
+  static constexpr unsigned long COMMAND_TIMEOUT_MS = 500;
+
+  /**
+   * Talk to the sensor through io, which must be set up at 9600 baud.
    */
-  explicit CO2(HardwareSerial &input);
+  explicit CO2(Stream &io);
   /**
    * Enable or disable Automatic Baseline Calibration.
    *
@@ -62,7 +129,7 @@ class CO2 {
    * lower values of CO2. We highly recommend doing a manual zero point
    * calibration before starting the sensor, and then perhaps once a year.
    */
-  void setABC(bool enabled) const;
+  bool setABC(bool enabled);
   /**
    * Invoke zero point calibration, setting the current value to 450ppm.
    *
@@ -70,7 +137,7 @@ class CO2 {
    * 450ppm. After exposing the sensor to the outside air for 20 minutes, you
    * can be reasonably sure that this is the case.
    */
-  void calibrateZeroPoint() const;
+  bool calibrateZeroPoint();
   /**
    * Set the second (high) point in the 2-point sensor calibration.
    *
@@ -79,7 +146,7 @@ class CO2 {
    * useful, but so far all tests have shown this to have an adverse effect on
    * precision (accuracy is not affected).
    */
-  void calibrateSpanPoint(uint16_t ppm) const;
+  bool calibrateSpanPoint(uint16_t ppm);
 
   /**
    * Retrieve the latest reading from the sensor.
@@ -87,15 +154,110 @@ class CO2 {
    * This doesn't necessarily perform a reading. The sensor performs readings
    * once every 5 seconds, so fetching readings more often than that gives you
    * no new information.
+   *
+   * Like the other commands, this only queues the command, and sends it once
+   * no other command with the same command byte is waiting for a response.
+   * Commands with different command bytes are in flight at the same time.
+   * Returns false if the queue is full. Queuing a command that is already
+   * queued or in flight does nothing.
+   */
+  bool requestReading();
+
+  /**
+   * Results are posted here from receive() or loop() when the sensor responded
+   * to a command, or after it didn't respond to any attempt, and passed on to
+   * the listeners by whoever calls commandDone.dispatch().
    */
-  void requestReading();
+  EventChannel<CommandResult, 4, 2> commandDone;
 
-  Callback<void(Reading const &)> newReading;
+  /**
+   * Parse whatever the sensor sent since the last call. loop() doesn't do this
+   * by itself, so that it only needs to happen when bytes have arrived (see
+   * SerialPort::takeRxEvent()).
+   */
+  void receive();
+
+  /**
+   * Readings are posted here while parsing the sensor response, and passed on
+   * to the listeners by whoever calls newReading.dispatch().
+   */
+  EventChannel<Reading, 4, 3> newReading;
+
+  /**
+   * The linear correction applied to readings, as a function of the sensor's
+   * temperature and raw ppm value.
+   */
+  using Calibration = RecursiveLeastSquares<2>;
+
+  /**
+   * Improve the correction using the actual CO2 concentration at the time of
+   * the last reading, e.g. from a reference meter next to the sensor.
+   */
+  void recalibrate(int ppmReference);
+  /**
+   * The current correction. Its state() can be saved and restored with
+   * setCalibration() to keep recalibrations across reboots.
+   */
+  Calibration const &calibration() const { return correction_; }
+  void setCalibration(Calibration::State const &state);
+
+  /**
+   * Use this temperature (on the sensor's own scale, e.g. from
+   * Climate::temperature(Climate::SENSOR_MHZ19B)) for the correction instead of
+   * the sensor's whole-degree reading. NaN goes back to the sensor's reading.
+   */
+  void setTemperature(float celsius) { temperature_ = celsius; }
 
  private:
-  void handleReading(byte (&response)[9]) const;
+  static constexpr int MAX_QUEUED = 4;
+  /**
+   * There are only 4 different commands, so at most 4 can be in flight.
+   */
+  static constexpr int MAX_IN_FLIGHT = 4;
+
+  struct Command {
+    byte frame[9];
+    uint8_t attempts;
+    /**
+     * The sensor must respond to the last attempt before this time.
+     */
+    unsigned long deadline;
+
+    byte command() const { return frame[2]; }
+  };
+
+  bool submit(byte (&frame)[9]);
+  void sendQueued(unsigned long now);
+  void transmit(Command &command, unsigned long now);
+  void complete(int inFlight, CommandOutcome outcome);
+  int findInFlight(byte command) const;
+
+  void handleFrame(byte const *frame);
+  void handleReading(byte const *response);
 
   Stream &input_;
+  FrameParser<MHZ19BFraming> parser_;
+  /**
+   * The rest of the frame must arrive before this time.
+   */
+  unsigned long frameDeadline_ = 0;
+  /**
+   * Commands waiting for an earlier command with the same command byte to be
+   * done.
+   */
+  Queue<Command, MAX_QUEUED> queued_;
+  /**
+   * Commands sent and waiting for a response, in no particular order.
+   */
+  Command inFlight_[MAX_IN_FLIGHT];
+  int inFlightSize_ = 0;
+  Calibration correction_;
+  float temperature_ = NAN;
+  /**
+   * Correction inputs of the last reading, for recalibrate().
+   */
+  float lastTemperature_ = 0;
+  int lastPpmRaw_ = -1;
 };
 
 Print &operator<<(Print &out, CO2::Reading const &reading);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "homectl/Matrix.h"
+
+/**
+ * Calibration values for the MH-Z19B: {Temp (Sensor), CO2 (Sensor), CO2
+ * (Temtop)}.
+ */
+static constexpr MatrixRow<3> co2Calibration[] = {
+    // Probably stable (measured after leaving the room with a closed
+    // door and windows).
+    {15, 481, 546},
+
+    {16, 441, 464},
+    {16, 491, 568},
+
+    {17, 468, 533},
+    {17, 535, 635},
+    {17, 544, 698},
+
+    {18, 416, 399},
+    {18, 749, 1099},
+    {18, 773, 1133},
+    {18, 814, 1200},
+
+    {20, 539, 699},
+    {20, 577, 776},
+
+    {21, 560, 739},
+
+    // Might not be stable (measured while in the room, door/windows
+    // closed).
+    {13, 540, 571},
+
+    {14, 580, 676},
+
+    {15, 482, 413},
+    {15, 571, 561},
+    {15, 582, 663},
+    {15, 621, 726},
+    {15, 631, 704},
+    {15, 686, 859},
+    {15, 704, 891},
+
+    {16, 621, 752},
+    {16, 600, 670},
+    {16, 631, 696},
+    {16, 644, 751},
+    {16, 723, 933},
+
+    {17, 609, 755},
+    {17, 618, 767},
+    {17, 637, 834},
+    {17, 642, 838},
+    {17, 734, 1009},
+
+    {18, 565, 681},
+
+    {19, 554, 736},
+
+    {20, 552, 725},
+};
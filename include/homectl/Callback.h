@@ -10,14 +10,17 @@ struct EventRegistered {
   void listen() { Registry::listen(callback, object); }
 };
 
+/**
+ * Turns a member function into a plain function taking the object as void *,
+ * so a callback can store any (object, method) pair in two pointers and call
+ * it without virtual dispatch.
+ */
 template <typename Sig>
-class Callback;
+struct Trampoline;
 
 template <typename R, typename... Args>
-class Callback<R(Args...)> {
+struct Trampoline<R(Args...)> {
   using Function = R(void *, Args...);
-  void *object_;
-  Function *method_;
 
   template <typename Object, R (Object::*Method)(Args...)>
   static R invoke(void *self, Args... args) {
@@ -28,6 +31,17 @@ class Callback<R(Args...)> {
   static R invoke(void *self, Args... args) {
     return (static_cast<Object const *>(self)->*Method)(args...);
   }
+};
+
+template <typename Sig>
+class Callback;
+
+template <typename R, typename... Args>
+class Callback<R(Args...)> {
+  using Invoke = Trampoline<R(Args...)>;
+  using Function = typename Invoke::Function;
+  void *object_;
+  Function *method_;
 
   template <typename Object, R (Object::*Method)(Args...)>
   struct DeferredListen {
@@ -42,13 +56,13 @@ class Callback<R(Args...)> {
   template <typename Object, R (Object::*Method)(Args...)>
   void listen(Object *self) {
     object_ = self;
-    method_ = invoke<Object, Method>;
+    method_ = Invoke::template invoke<Object, Method>;
   }
 
   template <typename Object, R (Object::*Method)(Args...) const>
   void listen(Object *self) {
     object_ = self;
-    method_ = invoke<Object, Method>;
+    method_ = Invoke::template invoke<Object, Method>;
   }
 
  public:
@@ -67,6 +81,68 @@ class Callback<R(Args...)> {
   }
 };
 
+template <int N, typename Sig>
+class Signal;
+
+/**
+ * Report that a Signal with room for capacity listeners got another one.
+ */
+void logSignalFull(int capacity);
+
+/**
+ * Callback that calls up to N listeners, in the order they started listening.
+ * The listeners are stored inline, so a Signal never allocates. Listeners
+ * beyond the first N are ignored, and logged as an error.
+ */
+template <int N, typename... Args>
+class Signal<N, void(Args...)> {
+  using Invoke = Trampoline<void(Args...)>;
+  using Function = typename Invoke::Function;
+
+  struct Listener {
+    void *object;
+    Function *method;
+  };
+
+  Listener listeners_[N];
+  int size_;
+
+  template <typename Object, void (Object::*Method)(Args...)>
+  struct DeferredListen {
+    using callback_type = Signal<N, void(Args...)>;
+    using object_type = Object;
+
+    static void listen(callback_type &callback, object_type &object) {
+      callback.template listen<Object, Method>(&object);
+    }
+  };
+
+  template <typename Object, void (Object::*Method)(Args...)>
+  void listen(Object *self) {
+    if (size_ < N) {
+      listeners_[size_++] = {self, Invoke::template invoke<Object, Method>};
+    } else {
+      logSignalFull(N);
+    }
+  }
+
+ public:
+  Signal() : size_(0) {}
+
+  void operator()(Args... args) const {
+    for (int i = 0; i < size_; ++i) {
+      listeners_[i].method(listeners_[i].object, args...);
+    }
+  }
+
+  template <typename Object, void (Object::*Method)(Args...)>
+  EventRegistered<DeferredListen<Object, Method>> listen(Object &object) {
+    return {*this, object};
+  }
+
+  int size() const { return size_; }
+};
+
 #define EV_OBJECT(CLASS)                                \
  public:                                                \
   template <typename Registry, typename... Rest>        \
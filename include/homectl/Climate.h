@@ -0,0 +1,72 @@
+#pragma once
+
+#include "homectl/KalmanFilter.h"
+
+/**
+ * Fused estimate of the room temperature and humidity from all sensors that
+ * measure them.
+ *
+ * The DHT22 is taken as the reference. The other sensors are assumed to read
+ * off by a constant amount (e.g. because they heat themselves up), and these
+ * offsets are estimated along with the room climate. Each sensor reading costs
+ * a bounded O(1) number of operations.
+ */
+class Climate {
+ public:
+  enum Sensor {
+    SENSOR_DHT22,
+    SENSOR_MHZ19B,
+    SENSOR_PMS5003T,
+  };
+
+  Climate();
+
+  /**
+   * Incorporate a reading taken at millis() == now. Pass NaN for values that
+   * the sensor doesn't measure or failed to read. Readings that are too far off
+   * the current estimate are ignored.
+   */
+  void add(Sensor sensor, unsigned long now, float temperature,
+           float humidity);
+
+  /**
+   * Room temperature in Celsius, as the DHT22 would measure it, or NaN if there
+   * is no estimate yet.
+   */
+  float temperature() const;
+  /**
+   * Relative humidity in percent, or NaN if there is no estimate yet.
+   */
+  float humidity() const;
+  /**
+   * Room temperature as the given sensor would measure it, or NaN if there is
+   * no estimate yet.
+   */
+  float temperature(Sensor sensor) const;
+
+  /**
+   * The filter's states: the room climate, and the offsets of the other
+   * sensors' readings from the DHT22's.
+   */
+  enum {
+    TEMPERATURE,
+    HUMIDITY,
+    MHZ19B_TEMPERATURE_OFFSET,
+    PMS5003T_TEMPERATURE_OFFSET,
+    PMS5003T_HUMIDITY_OFFSET,
+    STATES,
+  };
+
+  using Filter = KalmanFilter<STATES>;
+
+  Filter const &filter() const { return filter_; }
+
+ private:
+  static Filter::Vector temperatureRow(Sensor sensor);
+  static Filter::Vector humidityRow(Sensor sensor);
+
+  float estimate(Filter::Vector const &h) const;
+
+  Filter filter_;
+  unsigned long lastUpdate_ = 0;
+};
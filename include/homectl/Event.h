@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+
+#include "homectl/Callback.h"
+#include "homectl/Queue.h"
+
+/**
+ * Bounded lock-free mailbox of fixed-size events, passed from one producer task
+ * to one consumer task.
+ *
+ * The producer never blocks: if the consumer doesn't keep up, post() drops the
+ * event and counts it. The consumer decides when and on which task/core to
+ * handle events by calling drain().
+ */
+template <typename T, int Capacity>
+class Mailbox {
+  SpscQueue<T, Capacity> queue_;
+  std::atomic<uint32_t> dropped_{0};
+
+ public:
+  /**
+   * Producer: copy event into the mailbox. Returns false if it's full.
+   */
+  bool post(T const &event) {
+    T *const slot = queue_.reserve();
+    if (slot == nullptr) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    *slot = event;
+    queue_.commit();
+    return true;
+  }
+
+  /**
+   * Consumer: call handle for each posted event, oldest first. Returns the
+   * number of events handled.
+   */
+  template <typename Handler>
+  int drain(Handler &&handle) {
+    int handled = 0;
+    while (T const *event = queue_.front()) {
+      handle(*event);
+      queue_.pop();
+      ++handled;
+    }
+    return handled;
+  }
+
+  /**
+   * Number of events that didn't fit.
+   */
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+};
+
+/**
+ * Event source whose listeners are called on the consumer's schedule rather
+ * than the producer's. The producer posts events into a Mailbox, and whoever
+ * calls dispatch() passes them on to up to Listeners listeners, on their own
+ * task.
+ */
+template <typename T, int Capacity, int Listeners>
+class EventChannel {
+  using Listener = Signal<Listeners, void(T const &)>;
+
+  Mailbox<T, Capacity> mailbox_;
+  Listener listeners_;
+
+ public:
+  /**
+   * Producer: queue event for the listeners. Returns false if the mailbox is
+   * full.
+   */
+  bool post(T const &event) { return mailbox_.post(event); }
+
+  /**
+   * Consumer: call the listeners for all queued events. Returns the number of
+   * events dispatched.
+   */
+  int dispatch() {
+    return mailbox_.drain([this](T const &event) { listeners_(event); });
+  }
+
+  template <typename Object, void (Object::*Method)(T const &)>
+  auto listen(Object &object)
+      -> decltype(listeners_.template listen<Object, Method>(object)) {
+    return listeners_.template listen<Object, Method>(object);
+  }
+
+  uint32_t dropped() const { return mailbox_.dropped(); }
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string.h>
+
+#include "homectl/UART.h"
+
+/**
+ * SerialPort for tests, which receives whatever the test feeds it and counts
+ * the bytes written to it.
+ */
+template <size_t Capacity = 128>
+class FakeSerialPort : public SerialPort {
+  byte rx_[Capacity];
+  size_t begin_ = 0;
+  size_t end_ = 0;
+  bool rxEvent_ = false;
+
+ public:
+  size_t written = 0;
+  /**
+   * Number of times fed bytes didn't fit, like UartPort::overflows().
+   */
+  uint32_t overflows = 0;
+
+  /**
+   * Make bytes arrive, as the UART's RX interrupt would. Bytes that don't fit
+   * in Capacity are dropped, as the driver would drop them.
+   */
+  void feed(byte const *data, size_t size) {
+    memmove(rx_, rx_ + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+    if (size > Capacity - end_) {
+      size = Capacity - end_;
+      ++overflows;
+    }
+    memcpy(rx_ + end_, data, size);
+    end_ += size;
+    rxEvent_ = true;
+    received();
+  }
+
+  template <size_t N>
+  void feed(byte const (&data)[N]) {
+    feed(data, N);
+  }
+
+  bool takeRxEvent() override {
+    bool const event = rxEvent_;
+    rxEvent_ = false;
+    return event;
+  }
+
+  int available() override { return end_ - begin_; }
+  int read() override { return begin_ < end_ ? rx_[begin_++] : -1; }
+  int peek() override { return begin_ < end_ ? rx_[begin_] : -1; }
+  size_t write(uint8_t b) override {
+    ++written;
+    return 1;
+  }
+  using Print::write;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "homectl/Matrix.h"
+
+/**
+ * Integer-only evaluator for a fitted LinearFunction, for corrections that run
+ * at high rates.
+ *
+ * The coefficients are stored as 32 bit fixed point numbers with frac()
+ * fractional bits (Q format). The number of fractional bits is chosen at
+ * construction, which normally happens at compile time, as the largest that
+ * can't overflow the 32 bit accumulator for inputs within the given bounds.
+ * Evaluation is then one multiply-accumulate per variable and a shift, and
+ * rounds to the nearest integer. The result differs from the double version by
+ * at most errorBound().
+ */
+template <int Vars>
+class FixedPointFunction {
+  int32_t beta_[Vars + 1];
+  int frac_;
+
+  static constexpr int64_t roundToInt(double x) {
+    return x >= 0 ? int64_t(x + 0.5) : int64_t(x - 0.5);
+  }
+
+  /**
+   * Largest absolute value the accumulator can take, in units of the output.
+   * Adding 1 to each coefficient leaves room for rounding.
+   */
+  static constexpr double accumulatorRange(
+      LinearFunction<Vars> const &f, MatrixRow<Vars> const &inputBounds) {
+    double range = absolute(f.beta[0][0]) + 1;
+    for (int i = 0; i < Vars; ++i) {
+      range += (absolute(f.beta[i + 1][0]) + 1) * inputBounds[i];
+    }
+    return range;
+  }
+
+  static constexpr int chooseFrac(LinearFunction<Vars> const &f,
+                                  MatrixRow<Vars> const &inputBounds) {
+    double const range = accumulatorRange(f, inputBounds);
+    int frac = 30;
+    while (frac > 0 && range * double(int64_t(1) << frac) >= 2147483648.0) {
+      --frac;
+    }
+    return frac;
+  }
+
+ public:
+  /**
+   * Convert f for inputs with absolute values up to inputBounds.
+   */
+  constexpr FixedPointFunction(LinearFunction<Vars> const &f,
+                               MatrixRow<Vars> const &inputBounds)
+      : beta_{}, frac_(chooseFrac(f, inputBounds)) {
+    double const scale = double(int64_t(1) << frac_);
+    for (int i = 0; i < Vars + 1; ++i) {
+      beta_[i] = int32_t(roundToInt(f.beta[i][0] * scale));
+    }
+  }
+
+  template <typename... Args>
+  constexpr int32_t operator()(Args... args) const {
+    static_assert(sizeof...(args) == Vars,
+                  "need exactly one function argument per variable");
+    int32_t const x[Vars] = {int32_t(args)...};
+    int32_t acc = beta_[0] + (frac_ > 0 ? int32_t(1) << (frac_ - 1) : 0);
+    for (int i = 0; i < Vars; ++i) {
+      acc += beta_[i + 1] * x[i];
+    }
+    return acc >> frac_;
+  }
+
+  constexpr int frac() const { return frac_; }
+
+  /**
+   * Maximum difference to the double version of the function for inputs within
+   * bounds: up to half a unit of each rounded coefficient per unit of its
+   * input, plus rounding of the result.
+   */
+  constexpr double errorBound(MatrixRow<Vars> const &inputBounds) const {
+    double coefficientError = 1;
+    for (int i = 0; i < Vars; ++i) {
+      coefficientError += inputBounds[i];
+    }
+    return 0.5 + coefficientError * 0.5 / double(int64_t(1) << frac_);
+  }
+};
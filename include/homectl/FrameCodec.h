@@ -0,0 +1,228 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Read a big-endian unsigned integer of Size bytes.
+ */
+template <typename T, int Size = sizeof(T)>
+constexpr T readBigEndian(uint8_t const *data) {
+  T value = 0;
+  for (int i = 0; i < Size; ++i) {
+    value = T(value << 8) | data[i];
+  }
+  return value;
+}
+
+template <typename T, int Size = sizeof(T)>
+constexpr void writeBigEndian(uint8_t *data, T value) {
+  for (int i = Size - 1; i >= 0; --i) {
+    data[i] = uint8_t(value);
+    value = T(value >> 8);
+  }
+}
+
+/**
+ * Sum of data[from..to).
+ */
+constexpr uint32_t byteSum(uint8_t const *data, int from, int to) {
+  uint32_t sum = 0;
+  for (int i = from; i < to; ++i) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+/**
+ * Defaults for the parts of a framing policy that most protocols don't need.
+ */
+struct FramingDefaults {
+  /**
+   * Bytes that every frame ends with, after the checksum.
+   */
+  static constexpr uint32_t TAIL = 0;
+  static constexpr int TAIL_LEN = 0;
+};
+
+/**
+ * Encoding and decoding of the frames of a binary UART protocol, as described
+ * by a Policy with these static members:
+ *
+ * - SYNC, SYNC_LEN: the bytes every frame starts with, as one big-endian value.
+ * - HEADER_LEN: the number of bytes needed by frameLength().
+ * - MAX_LEN: the size of the largest frame.
+ * - frameLength(header): the size of the whole frame starting with this
+ *   header, or 0 if no such frame exists.
+ * - CHECKSUM_LEN, checksum(frame, len): the checksum of a frame, which is
+ *   stored big-endian right before the tail.
+ * - TAIL, TAIL_LEN: see FramingDefaults.
+ *
+ * Since all of these are compile-time constants, each function compiles to
+ * code for that protocol alone.
+ */
+template <typename Policy>
+struct FrameCodec {
+  static constexpr uint8_t syncByte(int i) {
+    return uint8_t(Policy::SYNC >> (8 * (Policy::SYNC_LEN - 1 - i)));
+  }
+
+  static constexpr uint8_t tailByte(int i) {
+    return uint8_t(Policy::TAIL >> (8 * (Policy::TAIL_LEN - 1 - i)));
+  }
+
+  /**
+   * Whether the first size bytes can be the start of a frame.
+   */
+  static constexpr bool synced(uint8_t const *frame, int size) {
+    for (int i = 0; i < Policy::SYNC_LEN && i < size; ++i) {
+      if (frame[i] != syncByte(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static constexpr int checksumOffset(int len) {
+    return len - Policy::TAIL_LEN - Policy::CHECKSUM_LEN;
+  }
+
+  /**
+   * Whether a complete frame of len bytes has the right checksum and tail.
+   */
+  static constexpr bool verify(uint8_t const *frame, int len) {
+    using Sum = decltype(Policy::checksum(frame, len));
+    if (readBigEndian<Sum, Policy::CHECKSUM_LEN>(
+            frame + checksumOffset(len)) != Policy::checksum(frame, len)) {
+      return false;
+    }
+    for (int i = 0; i < Policy::TAIL_LEN; ++i) {
+      if (frame[len - Policy::TAIL_LEN + i] != tailByte(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Fill in the sync bytes, checksum and tail of a frame whose other bytes are
+   * already filled in.
+   */
+  template <int N>
+  static constexpr void encode(uint8_t (&frame)[N]) {
+    static_assert(
+        N >= Policy::SYNC_LEN + Policy::CHECKSUM_LEN + Policy::TAIL_LEN,
+        "frame too small");
+    for (int i = 0; i < Policy::SYNC_LEN; ++i) {
+      frame[i] = syncByte(i);
+    }
+    for (int i = 0; i < Policy::TAIL_LEN; ++i) {
+      frame[N - Policy::TAIL_LEN + i] = tailByte(i);
+    }
+    writeBigEndian<decltype(Policy::checksum(frame, N)), Policy::CHECKSUM_LEN>(
+        frame + checksumOffset(N), Policy::checksum(frame, N));
+  }
+};
+
+/**
+ * Ways in which a byte stream was garbled, counted by FrameParser.
+ */
+struct FrameErrors {
+  /**
+   * Number of times bytes had to be skipped to find the next frame start.
+   */
+  uint32_t syncLosses = 0;
+  /**
+   * Frames with a length the protocol doesn't have.
+   */
+  uint32_t lengthErrors = 0;
+  /**
+   * Frames that were garbled. Many of these point at interference on the RX
+   * wire, or at a supply voltage that sags while the sensor measures.
+   */
+  uint32_t checksumFailures = 0;
+
+  uint32_t total() const {
+    return syncLosses + lengthErrors + checksumFailures;
+  }
+};
+
+/**
+ * Incremental parser for a FrameCodec protocol, which is fed one byte at a time
+ * and keeps any partial frame until the next byte comes in.
+ *
+ * When a frame turns out to be garbled, only its first byte is dropped, and the
+ * search for a frame start continues from the next byte. That way, a valid
+ * frame that starts inside a garbled one is still found.
+ */
+template <typename Policy>
+class FrameParser {
+ public:
+  using Codec = FrameCodec<Policy>;
+
+  /**
+   * Add a byte, and call handler(frame, len) for each complete, valid frame.
+   * The frame is only valid during the call.
+   */
+  template <typename Handler>
+  void push(uint8_t b, Handler &&handler) {
+    frame_[size_++] = b;
+    while (size_ > 0) {
+      if (!Codec::synced(frame_, size_)) {
+        skip(1);
+        continue;
+      }
+      if (size_ < Policy::HEADER_LEN) return;
+
+      int const len = Policy::frameLength(frame_);
+      if (len == 0) {
+        ++errors_.lengthErrors;
+        skip(1);
+        continue;
+      }
+      if (size_ < len) return;
+
+      if (!Codec::verify(frame_, len)) {
+        ++errors_.checksumFailures;
+        skip(1);
+        continue;
+      }
+      synced_ = true;
+      handler(static_cast<uint8_t const *>(frame_), len);
+      drop(len);
+    }
+  }
+
+  /**
+   * Number of bytes of the partial frame received so far.
+   */
+  int size() const { return size_; }
+  void clear() { size_ = 0; }
+
+  FrameErrors const &errors() const { return errors_; }
+
+ private:
+  void drop(int count) {
+    size_ -= count;
+    memmove(frame_, frame_ + count, size_);
+  }
+
+  void skip(int count) {
+    if (synced_) {
+      ++errors_.syncLosses;
+      synced_ = false;
+    }
+    // Nothing before the next first sync byte can start a frame either.
+    while (count < size_ && frame_[count] != Codec::syncByte(0)) ++count;
+    drop(count);
+  }
+
+  uint8_t frame_[Policy::MAX_LEN];
+  int size_ = 0;
+  /**
+   * Whether the last bytes we saw were part of a valid frame, so that a run of
+   * garbage counts as one sync loss.
+   */
+  bool synced_ = true;
+  FrameErrors errors_;
+};
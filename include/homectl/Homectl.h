@@ -8,9 +8,12 @@
 #include "homectl/Blink.h"
 #include "homectl/Button.h"
 #include "homectl/CO2.h"
+#include "homectl/Climate.h"
 #include "homectl/Logger.h"
 #include "homectl/Matrix.h"
 #include "homectl/PMS5003T.h"
+#include "homectl/Scheduler.h"
+#include "homectl/UART.h"
 #include "homectl/UsbEcho.h"
 
 class Homectl {
@@ -19,13 +22,31 @@ class Homectl {
       LED = 2,
       BUTTON = 4,
       DHT = 5,
+      CO2_RX = 16,
+      CO2_TX = 17,
     };
   };
 
+  /**
+   * Everything that runs on the main loop, in the order it runs when several
+   * are due at once.
+   */
+  enum Task {
+    TASK_BLINK,
+    TASK_BUTTON,
+    TASK_USB_ECHO,
+    TASK_SENSORS,
+    TASK_LOG,
+    TASKS,
+  };
+
   struct State {
+    Scheduler<TASKS> scheduler;
+    UartPort co2Port{UART_NUM_2};
     CO2 co2{
         co2.newReading.listen<State, &State::showCO2Reading>(*this),
-        Serial2,
+        co2.commandDone.listen<State, &State::handleCO2Command>(*this),
+        co2Port,
     };
     Blink blink{Pins::LED};
     PushButton button{
@@ -35,21 +56,30 @@ class Homectl {
     LiquidCrystal_I2C lcd{0x27, LCD_COLS, LCD_ROWS};
     UsbEcho usbEcho;
     DHT dht{Pins::DHT, DHT22};
+    Climate climate;
+    UartPort pms5003tPort{UART_NUM_1};
     PMS5003T pms5003t{
         pms5003t.newReading.listen<State, &State::showPMSReading>(*this),
-        Serial1,
+        pms5003tPort,
     };
 
-    unsigned long lastTime = millis();
-    unsigned long iterations = 0;
+    /**
+     * Number of times the main loop woke up since the last log.
+     */
+    unsigned long wakeups = 0;
 
+    void pollSensors();
+    void sensorReceived() { scheduler.notify(TASK_SENSORS); }
     void showPMSReading(PMS5003T::Reading const &reading);
     void showCO2Reading(CO2::Reading const &reading);
+    void handleCO2Command(CO2::CommandResult const &result);
+    void addClimateReading(Climate::Sensor sensor, float temperature,
+                           float humidity);
   };
 
   State state;
 
-  void handleLoopTimer();
+  void logSensors();
 
  public:
   static constexpr uint8_t LCD_COLS = 20;
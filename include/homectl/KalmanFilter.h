@@ -0,0 +1,98 @@
+#pragma once
+
+#include <limits>
+
+#include "homectl/Matrix.h"
+
+/**
+ * Kalman filter over a fixed number of slowly drifting quantities, updated by
+ * one scalar measurement at a time.
+ *
+ * Each state follows a random walk whose variance grows by a fixed rate per
+ * unit of time (see predict()). A measurement observes a linear combination of
+ * the states (see update()), e.g. a temperature plus a sensor's offset. Scalar
+ * updates need no matrix inversion, and both operations cost O(States²).
+ */
+template <int States, typename T = float>
+class KalmanFilter {
+ public:
+  using Vector = MatrixRow<States, T>;
+  using Estimate = Matrix<States, 1, T>;
+  using Covariance = Matrix<States, States, T>;
+
+  struct State {
+    Estimate x;
+    Covariance P;
+  };
+
+ private:
+  State state_;
+
+ public:
+  /**
+   * Start out at x with independent errors of the given variances.
+   */
+  constexpr KalmanFilter(Vector const &x, Vector const &variance)
+      : state_{Estimate{}, Covariance{}} {
+    for (int i = 0; i < States; ++i) {
+      state_.x[i][0] = x[i];
+      state_.P[i][i] = variance[i];
+    }
+  }
+
+  /**
+   * Let time dt pass, during which state i drifts by a variance of
+   * noiseRate[i] * dt.
+   */
+  constexpr void predict(Vector const &noiseRate, T dt) {
+    for (int i = 0; i < States; ++i) {
+      state_.P[i][i] += noiseRate[i] * dt;
+    }
+  }
+
+  /**
+   * Incorporate a measurement z of h · x with the given noise variance.
+   *
+   * Measurements more than gate standard deviations away from the predicted
+   * value are rejected, leaving the filter unchanged. Returns whether the
+   * measurement was used.
+   */
+  constexpr bool update(Vector const &h, T z, T variance,
+                        T gate = std::numeric_limits<T>::infinity()) {
+    // Innovation y = z - h x, with variance s = h P hᵀ + r.
+    Vector Ph{};
+    T s = variance;
+    T y = z;
+    for (int i = 0; i < States; ++i) {
+      for (int j = 0; j < States; ++j) {
+        Ph[i] += state_.P[i][j] * h[j];
+      }
+      s += h[i] * Ph[i];
+      y -= h[i] * state_.x[i][0];
+    }
+
+    if (y * y > gate * gate * s) {
+      return false;
+    }
+
+    for (int i = 0; i < States; ++i) {
+      state_.x[i][0] += Ph[i] / s * y;
+    }
+
+    // P = P - k hᵀ P, with gain k = P h / s. As in RecursiveLeastSquares,
+    // compute one triangle and mirror it to keep P symmetric.
+    for (int i = 0; i < States; ++i) {
+      for (int j = 0; j <= i; ++j) {
+        T const p = state_.P[i][j] - Ph[i] * Ph[j] / s;
+        state_.P[i][j] = p;
+        state_.P[j][i] = p;
+      }
+    }
+    return true;
+  }
+
+  constexpr T operator[](int i) const { return state_.x[i][0]; }
+  constexpr T variance(int i) const { return state_.P[i][i]; }
+
+  constexpr State const &state() const { return state_; }
+};
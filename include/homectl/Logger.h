@@ -2,6 +2,11 @@
 
 #include <Arduino.h>
 
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <utility>
+
 #include "homectl/Print.h"
 #include "homectl/Queue.h"
 
@@ -22,112 +27,674 @@ constexpr bool DEBUG = true;  // Not unit test.
 constexpr bool DEBUG = false;
 #endif
 
-struct LoggerTraits {
+/**
+ * In deferred logging mode, LOG and LOGF only copy their arguments into the log
+ * queue, and all formatting happens on the logger core. Calls with arguments
+ * that might not outlive the call (e.g. char pointers) are still formatted
+ * eagerly on the caller's core.
+ */
+constexpr bool DEFERRED_LOGGING = true;
+
+/**
+ * Log severity, from most to least chatty.
+ */
+enum LogLevel : uint8_t {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARNING,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_NONE,
+};
+
+/**
+ * Parts of the program with their own log level thresholds. Each source file
+ * that logs says which module it belongs to with LOG_MODULE().
+ */
+enum LogModule : uint8_t {
+  LOG_MODULE_HOMECTL,
+  LOG_MODULE_CO2,
+  LOG_MODULE_PMS5003T,
+  LOG_MODULE_UART,
+  LOG_MODULE_TEST,
+  LOG_MODULE_COUNT,
+};
+
+/**
+ * Compile-time log level threshold per module. Log statements below this level
+ * are compiled out entirely, including the evaluation of their arguments.
+ */
+constexpr LogLevel logMinLevel(LogModule module) {
+  switch (module) {
+    case LOG_MODULE_TEST:
+      // Lets the unit tests check that debug logging is compiled out.
+      return LOG_LEVEL_INFO;
+    default:
+      return PRODUCTION ? LOG_LEVEL_WARNING : LOG_LEVEL_DEBUG;
+  }
+}
+
+/**
+ * Runtime log level threshold per module, on top of logMinLevel(). Starts out
+ * at LOG_LEVEL_DEBUG for all modules.
+ */
+extern std::atomic<uint8_t> logThresholds[LOG_MODULE_COUNT];
+
+static inline void setLogLevel(LogModule module, LogLevel level) {
+  logThresholds[module].store(level, std::memory_order_relaxed);
+}
+
+template <LogLevel Level, LogModule Module>
+struct LogCompiledIn
+    : std::integral_constant<bool, DEBUG && Level >= logMinLevel(Module)> {};
+
+static inline bool logLevelEnabled(LogLevel level, LogModule module) {
+  return level >= logThresholds[module].load(std::memory_order_relaxed);
+}
+
+/**
+ * Declare the module of the current source file.
+ */
+#define LOG_MODULE(NAME) \
+  static constexpr LogModule logModule = LOG_MODULE_##NAME
+
+/**
+ * What the logger does when a line doesn't fit in the queue.
+ */
+enum LogOverflowPolicy {
+  /**
+   * Drop the line (or, for text lines, the part that doesn't fit).
+   */
+  LOG_DROP_NEWEST,
   /**
-   * The maximum length of a log line.
+   * Wake the writer and wait up to BLOCK_TIMEOUT milliseconds for it to make
+   * space, then drop.
    */
-  static constexpr int LINE_LEN = 128;
+  LOG_BLOCK,
+};
+
+struct LoggerTraits {
   /**
-   * The maximum number of log lines this logger buffers.
+   * The number of bytes of log records this logger buffers. Each line takes
+   * its length plus 2 bytes.
    */
-  static constexpr int BUFFER_LEN = 10;
+  static constexpr int BUFFER_SIZE = 1324;
   /**
-   * Number of milliseconds to sleep between writing log lines to the output.
+   * Maximum number of milliseconds between writing log lines to the output.
    */
   static constexpr int DELAY = 100;
+  /**
+   * Number of queued bytes at which the writer is woken up before DELAY is
+   * over.
+   */
+  static constexpr int HIGH_WATER = BUFFER_SIZE / 2;
+  static constexpr LogOverflowPolicy OVERFLOW_POLICY = LOG_DROP_NEWEST;
+  /**
+   * Maximum number of milliseconds to wait for space with LOG_BLOCK.
+   */
+  static constexpr int BLOCK_TIMEOUT = 10;
+  /**
+   * Maximum number of outputs each line is written to.
+   */
+  static constexpr int MAX_SINKS = 3;
+  /**
+   * Number of bytes of formatted lines collected before they are handed to the
+   * outputs in a single write.
+   */
+  static constexpr int BATCH_SIZE = 256;
+  /**
+   * Number of bytes of the most recent output kept in memory that survives a
+   * soft reset.
+   */
+  static constexpr int CRASH_LOG_SIZE = 1024;
+};
+
+/**
+ * Counters for tuning the logger's BUFFER_SIZE and DELAY.
+ */
+struct LoggerStats {
+  /**
+   * Lines that were dropped entirely.
+   */
+  uint32_t droppedLines;
+  /**
+   * Text lines that were cut short.
+   */
+  uint32_t truncatedLines;
+  /**
+   * Total bytes of dropped and truncated lines that didn't make it into the
+   * queue.
+   */
+  uint32_t droppedBytes;
+  /**
+   * Highest number of queued bytes seen after committing a line.
+   */
+  uint32_t peakUsage;
+};
+
+/**
+ * Static description of a LOG/LOGF call site, built at compile time by
+ * LOG_SITE().
+ */
+struct LogSite {
+  /**
+   * Base name of the source file, without directories.
+   */
+  char const *file;
+  char const *func;
+  int line;
+  LogLevel level;
+};
+
+/**
+ * Return the part of path after the last (back)slash.
+ */
+constexpr char const *logBasename(char const *path) {
+  char const *base = path;
+  for (char const *p = path; *p != '\0'; ++p) {
+    if (*p == '/' || *p == '\\') {
+      base = p + 1;
+    }
+  }
+  return base;
+}
+
+/**
+ * Pointer to a static LogSite for the current source location. This uses a GCC
+ * statement expression, since __func__ has to refer to the enclosing function.
+ */
+#define LOG_SITE(LEVEL)                                               \
+  ({                                                                  \
+    static constexpr LogSite logSite{logBasename(__FILE__), __func__, \
+                                     __LINE__, LEVEL};                \
+    &logSite;                                                         \
+  })
+
+/**
+ * Formats the arguments of a deferred log record. Returns the number of bytes
+ * of arguments it consumed.
+ */
+using LogDecoder = size_t (*)(Print &out, uint8_t const *args);
+
+/**
+ * How a log argument of type T is stored in a deferred log record.
+ *
+ * Only values we can copy byte-wise and that don't point at memory that may be
+ * gone by the time the record is formatted can be deferred.
+ */
+template <typename T, typename Enable = void>
+struct LogArg {
+  static constexpr bool deferrable = false;
+};
+
+template <typename T>
+struct LogArg<T, typename std::enable_if<std::is_trivially_copyable<T>::value &&
+                                         !std::is_pointer<T>::value &&
+                                         !std::is_array<T>::value>::type> {
+  static constexpr bool deferrable = true;
+  using Stored = typename std::remove_cv<T>::type;
+
+  static Stored store(T const &arg) { return arg; }
+  static void print(Print &out, Stored const &arg) { out << arg; }
+};
+
+/**
+ * Flash strings live forever, so we only need to store the pointer.
+ */
+template <>
+struct LogArg<__FlashStringHelper const *> {
+  static constexpr bool deferrable = true;
+  using Stored = __FlashStringHelper const *;
+
+  static Stored store(Stored arg) { return arg; }
+  static void print(Print &out, Stored arg) { out << arg; }
+};
+
+/**
+ * Copy of a char array, stored in the record itself, since the array may be a
+ * local or a member that is gone by the time the record is formatted. Always
+ * NUL-terminated, even if the array isn't.
+ */
+template <size_t N>
+struct LogChars {
+  char data[N + 1];
+};
+
+/**
+ * Constant char arrays (mostly string literals) are copied into the record,
+ * which is a bounded memcpy. Mutable char arrays are buffers whose length has
+ * nothing to do with their contents, and are formatted eagerly.
+ */
+template <size_t N>
+struct LogArg<char const[N]> {
+  static constexpr bool deferrable = true;
+  using Stored = LogChars<N>;
+
+  static Stored store(char const (&arg)[N]) {
+    Stored stored;
+    memcpy(stored.data, arg, N);
+    stored.data[N] = '\0';
+    return stored;
+  }
+  static void print(Print &out, Stored const &arg) { out.print(arg.data); }
+};
+
+/**
+ * What a stored argument is passed to printf as.
+ */
+template <typename T>
+T const &logfArg(T const &arg) {
+  return arg;
+}
+
+template <size_t N>
+char const *logfArg(LogChars<N> const &arg) {
+  return arg.data;
+}
+
+static constexpr bool allOf() { return true; }
+
+template <typename... Rest>
+constexpr bool allOf(bool first, Rest... rest) {
+  return first && allOf(rest...);
+}
+
+template <typename T>
+void encodeLogArg(Print &out, T const &arg) {
+  typename LogArg<T>::Stored const stored = LogArg<T>::store(arg);
+  out.write(reinterpret_cast<uint8_t const *>(&stored), sizeof stored);
+}
+
+template <typename T>
+T decodeLogArg(uint8_t const *data) {
+  T arg;
+  memcpy(&arg, data, sizeof arg);
+  return arg;
+}
+
+/**
+ * Deferred form of LOG: stores each argument in turn, and prints them with
+ * operator<< on the logger core.
+ */
+template <typename... Args>
+struct DeferredLog {
+  static constexpr bool deferrable = allOf(LogArg<Args>::deferrable...);
+
+  static void encode(Print &out, Args const &... args) {
+    int const unused[] = {0, (encodeLogArg<Args>(out, args), 0)...};
+    (void)unused;
+  }
+
+  static size_t decode(Print &out, uint8_t const *data) {
+    size_t off = 0;
+    int const unused[] = {0, (off += decodeArg<Args>(out, data + off), 0)...};
+    (void)unused;
+    return off;
+  }
+
+ private:
+  template <typename T>
+  static int decodeArg(Print &out, uint8_t const *data) {
+    using Stored = typename LogArg<T>::Stored;
+    // Not all stored types are default-constructible, so we print straight
+    // out of an aligned copy.
+    alignas(Stored) uint8_t buf[sizeof(Stored)];
+    memcpy(buf, data, sizeof buf);
+    LogArg<T>::print(out, *reinterpret_cast<Stored const *>(buf));
+    return sizeof(Stored);
+  }
+};
+
+/**
+ * Deferred form of LOGF: stores the format string and the arguments, and calls
+ * printf on the logger core.
+ */
+template <typename... Args>
+struct DeferredLogf {
+  static constexpr bool deferrable = allOf(LogArg<Args>::deferrable...);
+
+  static void encode(Print &out, __FlashStringHelper const *fmt,
+                     Args const &... args) {
+    encodeLogArg(out, fmt);
+    int const unused[] = {0, (encodeLogArg<Args>(out, args), 0)...};
+    (void)unused;
+  }
+
+  static size_t decode(Print &out, uint8_t const *data) {
+    return decode(out, data, std::index_sequence_for<Args...>());
+  }
+
+ private:
+  static constexpr size_t offset(size_t index) {
+    size_t const sizes[] = {sizeof(__FlashStringHelper const *),
+                            sizeof(typename LogArg<Args>::Stored)...};
+    size_t off = 0;
+    for (size_t i = 0; i <= index; ++i) {
+      off += sizes[i];
+    }
+    return off;
+  }
+
+  template <size_t... I>
+  static size_t decode(Print &out, uint8_t const *data,
+                       std::index_sequence<I...>) {
+    auto const fmt = decodeLogArg<__FlashStringHelper const *>(data);
+#ifdef TEENSY
+    out.printf(fmt, logfArg(decodeLogArg<typename LogArg<Args>::Stored>(
+                        data + offset(I)))...);
+#else
+    // The decoded arguments are temporaries that live until printf returns.
+    out.printf(flashString(fmt),
+               logfArg(decodeLogArg<typename LogArg<Args>::Stored>(
+                   data + offset(I)))...);
+#endif
+    return offset(sizeof...(Args));
+  }
+};
+
+/**
+ * Output that keeps the last Size bytes written to it. The storage is separate
+ * from the ring so it can be placed in memory that isn't cleared on a soft
+ * reset (RTC_NOINIT_ATTR), which keeps the lines leading up to a crash around
+ * for the next boot.
+ */
+template <size_t Size>
+class LogRing : public Print {
+ public:
+  struct Storage {
+    uint32_t magic;
+    /**
+     * Where the next byte goes.
+     */
+    uint32_t head;
+    /**
+     * Number of valid bytes, at most Size.
+     */
+    uint32_t used;
+    uint8_t data[Size];
+  };
+
+ private:
+  static constexpr uint32_t MAGIC = 0x474f4c48;  // "HLOG"
+
+  Storage &storage_;
+
+ public:
+  /**
+   * Take over the contents of storage if it holds a valid ring, e.g. from
+   * before a soft reset. Otherwise (e.g. after power-on), start out empty.
+   */
+  explicit LogRing(Storage &storage) : storage_(storage) {
+    if (storage_.magic != MAGIC || storage_.head >= Size ||
+        storage_.used > Size) {
+      clear();
+    }
+  }
+
+  void clear() {
+    storage_.magic = MAGIC;
+    storage_.head = 0;
+    storage_.used = 0;
+  }
+
+  size_t size() const { return storage_.used; }
+
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(uint8_t const *buffer, size_t size) override {
+    size_t const written = size;
+    if (size > Size) {
+      buffer += size - Size;
+      size = Size;
+    }
+    size_t const first = std::min<size_t>(size, Size - storage_.head);
+    memcpy(storage_.data + storage_.head, buffer, first);
+    memcpy(storage_.data, buffer + first, size - first);
+    storage_.head = (storage_.head + size) % Size;
+    storage_.used = std::min<size_t>(storage_.used + size, Size);
+    return written;
+  }
+  using Print::write;
+
+  /**
+   * Write the contents to out, oldest first.
+   */
+  void printTo(Print &out) const {
+    size_t const start = (storage_.head + Size - storage_.used) % Size;
+    size_t const first = std::min<size_t>(storage_.used, Size - start);
+    out.write(storage_.data + start, first);
+    out.write(storage_.data, storage_.used - first);
+  }
 };
 
 /**
  * Thread-safe asynchronous logger.
  *
- * The logger allocates (LINE_LEN + sizeof(uint8_t *) * BUFFER_LEN) of static
- * memory up front, and then never resizes to avoid non-stack-like dynamic
- * allocations.
+ * The logger allocates BUFFER_SIZE bytes of static memory up front, and then
+ * never resizes to avoid non-stack-like dynamic allocations.
  *
  * The actual log writing happens in a separate thread, running on a separate
  * core (core 0), while the log formatting happens on the caller's core (core
  * 1). We perform the actual I/O on a separate thread since the most
  * time-consuming part is the synchronous output to USB.
  *
- * Besides LINE_LEN and BUFFER_LEN, the third configurable value is DELAY. This
- * influences how frequently we flush the log lines and write to the output.
+ * Lines are passed between the cores through a lock-free single-producer,
+ * single-consumer queue of length-prefixed records packed into one byte arena.
+ * A Logger formats straight into the arena on construction and publishes the
+ * record on destruction, and the writer task prints the record in place before
+ * releasing it. This means that only one task (the main loop) may log, and only
+ * one Logger may be alive at a time.
+ *
+ * In DEFERRED_LOGGING mode, a record contains the call site, the timestamp and
+ * the raw bytes of the log arguments along with a decoder function that knows
+ * their types (which serves as compile-time message id). The writer task then
+ * does all the formatting. Anything written to such a Logger after the
+ * arguments is appended to the formatted line as plain text.
+ *
+ * Besides BUFFER_SIZE, the second configurable value is DELAY. This influences
+ * how frequently we flush the log lines and write to the output. The writer is
+ * also woken up early when a line is committed that takes the queue above
+ * HIGH_WATER bytes or that was marked urgent(). What happens when the queue is
+ * full is set by OVERFLOW_POLICY, and stats() counts what was lost so the
+ * values can be tuned. Warnings and errors are always urgent.
+ *
+ * Every line is written to each of the outputs: the one set by setOutput()
+ * (Serial by default), any added with addSink(), and the crash log. The writer
+ * collects lines into a batch of up to BATCH_SIZE bytes and hands each output
+ * the whole batch in one write, since every write to USB is a transaction of
+ * its own.
  *
  * Overall, it depends on how much you're logging, how busy you want to make the
  * logger core, and how much memory you are willing to allocate to the logger.
- * If you're logging very long lines, keep in mind that the buffer will have
- * allocated BUFFER_LEN times the memory for the longest line.
+ * Short lines only take as much memory as they need, and a line is only
+ * truncated if it doesn't fit in the remaining free space.
  */
 template <bool Enabled, typename TraitsT = LoggerTraits>
 class Logger : public Print {
  private:
   using Traits = TraitsT;
 
-  struct LogLine {
-    uint8_t data[Traits::LINE_LEN];
-    uint8_t *cur;
+  using LogQueue = RecordQueue<Traits::BUFFER_SIZE>;
+  static_assert(sizeof(LogQueue) == 1328,
+                "unexpected memory size of log queue");
 
-    bool empty() const { return cur == nullptr || cur == data; }
+  using CrashLog = LogRing<Traits::CRASH_LOG_SIZE>;
 
+  /**
+   * The first byte of each record says how to print the rest.
+   */
+  enum RecordKind : uint8_t {
     /**
-     * The constructor does not zero-initialise data, since we're never going to
-     * read it anyway and zeroing out all those bytes takes a long time.
+     * Fully formatted text.
      */
-    LogLine() : cur(data) {}
-    LogLine(LogLine &&rhs) { *this = std::move(rhs); }
-    LogLine &operator=(LogLine &&rhs) {
-      // Only copy over the actually relevant bytes, leaving garbage in the
-      // remaining bytes.
-      memcpy(data, rhs.data, rhs.cur - rhs.data);
-      cur = data + (rhs.cur - rhs.data);
-      rhs.cur = rhs.data;
-      return *this;
-    }
+    RECORD_TEXT,
+    /**
+     * A DeferredHeader followed by the encoded arguments and optional text.
+     */
+    RECORD_DEFERRED,
   };
 
-  using LogQueue = ThreadSafeQueue<LogLine, Traits::BUFFER_LEN>;
-  static_assert(sizeof(LogQueue) == 1328,
-                "unexpected memory size of log queue");
+  struct DeferredHeader {
+    LogDecoder decode;
+    LogSite const *site;
+    unsigned long timestamp;
+  };
+
+  /**
+   * The outputs, of which the first is the one set by setOutput().
+   */
+  struct Sinks {
+    Print *out[Traits::MAX_SINKS];
+    int count;
+  };
+
+  /**
+   * Collects formatted lines and writes them to all sinks at once.
+   */
+  class Batch : public Print {
+    uint8_t data_[Traits::BATCH_SIZE];
+    size_t size_ = 0;
 
-  LogLine line_;
+   public:
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(uint8_t const *buffer, size_t size) override;
+    using Print::write;
 
-  static Print *&output();
+    void flush();
+  };
+
+  struct Counters {
+    std::atomic<uint32_t> droppedLines{0};
+    std::atomic<uint32_t> truncatedLines{0};
+    std::atomic<uint32_t> droppedBytes{0};
+    std::atomic<uint32_t> peakUsage{0};
+  };
+
+  /**
+   * The record this logger is writing to. Invalid if the queue was full (in
+   * which case the line is dropped).
+   */
+  typename LogQueue::Writer line_{0, 0, false};
+  /**
+   * Whether this logger started a line at all.
+   */
+  bool started_ = false;
+  /**
+   * Whether this is a binary record, which must be dropped rather than
+   * truncated if it doesn't fit.
+   */
+  bool deferred_ = false;
+  /**
+   * Whether to wake up the writer as soon as this line is committed.
+   */
+  bool urgent_ = false;
+  /**
+   * Number of bytes of this line that didn't make it into the queue.
+   */
+  uint16_t dropped_ = 0;
+
+  static Sinks &sinks();
+  static Batch &batch();
+  static CrashLog &crashLog();
   static LogQueue &queue();
   static TaskHandle_t &task();
+  static Counters &counters();
 
+  static size_t printHeader(Print &out, LogSite const &site, Time timestamp);
+  static void printRecord(Print &out, uint8_t const *data, size_t size);
+  static void printQueued(Print &out);
+  static void reportDrops(Print &out);
   static void writeLines(void *);
+  static void wakeWriter();
+  static bool waitForWriter(unsigned long start);
+
+  void begin();
+  size_t overflow(uint8_t const *buffer, size_t size);
+  void finish();
 
  public:
-  Logger(__FlashStringHelper const *file, int line, char const *func,
-         Time timestamp);
+  /**
+   * Start a line of text, formatting the line header right away.
+   */
+  Logger(LogSite const &site, Time timestamp);
+  /**
+   * Start a deferred record. The caller must write the encoded arguments that
+   * decode expects right after. The site must outlive the record.
+   */
+  Logger(LogDecoder decode, LogSite const &site, Time timestamp);
   Logger() {}
-  Logger(Logger &&other) : line_(std::move(other.line_)) {}
+  Logger(Logger &&other)
+      : line_(other.line_),
+        started_(other.started_),
+        deferred_(other.deferred_),
+        urgent_(other.urgent_),
+        dropped_(other.dropped_) {
+    other.started_ = false;
+  }
   ~Logger() {
-    if (!line_.empty()) {
-      queue().add(std::move(line_));
+    if (started_) {
+      finish();
     }
   }
-  size_t write(uint8_t b) override {
-    if (line_.cur == nullptr || line_.cur == line_.data + Traits::LINE_LEN) {
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(uint8_t const *buffer, size_t size) override {
+    if (!started_) {
       return 0;
     }
-    *line_.cur = b;
-    ++line_.cur;
-    return 1;
+    if (dropped_ != 0 || !queue().put(line_, buffer, size)) {
+      return overflow(buffer, size);
+    }
+    return size;
+  }
+  using Print::write;
+
+  /**
+   * Wake up the writer as soon as this line is done, instead of waiting for
+   * the next DELAY to pass.
+   */
+  Logger &urgent() {
+    urgent_ = true;
+    return *this;
   }
 
+  /**
+   * Replace the primary output (Serial by default).
+   */
   static void setOutput(Print &out);
+  /**
+   * Also write all lines to out. Returns false if there are already MAX_SINKS
+   * outputs. Sinks should be added and removed before setup() or while no
+   * lines are written.
+   */
+  static bool addSink(Print &out);
+  static void removeSink(Print &out);
+  /**
+   * Print what was logged before the last soft reset, if anything. Call this
+   * before logging anything, since the crash log keeps filling up after boot.
+   */
+  static void printCrashLog(Print &out);
   static void setup();
+  /**
+   * Write out all queued lines. Must only be called from one task at a time,
+   * which is the writer task once setup() has been called.
+   */
+  static void flush();
+  static LoggerStats stats();
 };
 
 template <typename Traits>
 class Logger<false, Traits> : public Print {
  public:
   Logger() {}
-  Logger(__FlashStringHelper const *file, int line, char const *func,
-         Time timestamp) {}
+  Logger(LogSite const &site, Time timestamp) {}
+  Logger(LogDecoder decode, LogSite const &site, Time timestamp) {}
   size_t write(uint8_t b) override { return 0; }
+  Logger &urgent() { return *this; }
 
+  static bool addSink(Print &out) { return false; }
+  static void removeSink(Print &out) {}
+  static void printCrashLog(Print &out) {}
   static void setup() {}
+  static void flush() {}
+  static LoggerStats stats() { return {}; }
 };
 
 static inline void doPrint(Print &out) {}
@@ -138,30 +705,95 @@ void doPrint(Print &out, Arg const &arg, Args &&...args) {
   doPrint(out, args...);
 }
 
-template <typename... Args>
-Logger<DEBUG> doLog(__FlashStringHelper const *file, int line, char const *func,
-                    Args &&...args) {
-  Logger<DEBUG> logger(file, line, func, Time(millis()));
+template <bool Enabled = DEBUG, typename... Args>
+Logger<Enabled> doLogEager(LogSite const &site, Args &&...args) {
+  Logger<Enabled> logger(site, Time(millis()));
   doPrint(logger, args...);
   return logger;
 }
 
+template <bool Enabled = DEBUG, typename... Args>
+Logger<Enabled> doLogDeferred(LogSite const &site, Args &&...args) {
+  using Log = DeferredLog<typename std::remove_reference<Args>::type...>;
+  Logger<Enabled> logger(&Log::decode, site, Time(millis()));
+  Log::encode(logger, args...);
+  return logger;
+}
+
 template <typename... Args>
-Logger<DEBUG> doLogf(__FlashStringHelper const *file, int line,
-                     char const *func, __FlashStringHelper const *fmt,
-                     Args &&...args) {
-  Logger<DEBUG> logger(file, line, func, Time(millis()));
+Logger<DEBUG> doLog(std::false_type, Args &&...args) {
+  return doLogEager(std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+Logger<DEBUG> doLog(std::true_type, Args &&...args) {
+  return doLogDeferred(std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+Logger<DEBUG> doLog(LogSite const &site, Args &&...args) {
+  using Log = DeferredLog<typename std::remove_reference<Args>::type...>;
+  return doLog(std::integral_constant<bool, DEFERRED_LOGGING && Log::deferrable>(),
+               site, std::forward<Args>(args)...);
+}
+
+template <bool Enabled = DEBUG, typename... Args>
+Logger<Enabled> doLogfEager(LogSite const &site, __FlashStringHelper const *fmt,
+                            Args &&...args) {
+  Logger<Enabled> logger(site, Time(millis()));
 #ifdef TEENSY
   logger.printf(fmt, args...);
 #else
-  logger.printf(String(fmt).begin(), args...);
+  logger.printf(flashString(fmt), args...);
 #endif
   return logger;
 }
 
+template <bool Enabled = DEBUG, typename... Args>
+Logger<Enabled> doLogfDeferred(LogSite const &site,
+                               __FlashStringHelper const *fmt, Args &&...args) {
+  using Log = DeferredLogf<typename std::remove_reference<Args>::type...>;
+  Logger<Enabled> logger(&Log::decode, site, Time(millis()));
+  Log::encode(logger, fmt, args...);
+  return logger;
+}
+
+template <typename... Args>
+Logger<DEBUG> doLogf(std::false_type, Args &&...args) {
+  return doLogfEager(std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+Logger<DEBUG> doLogf(std::true_type, Args &&...args) {
+  return doLogfDeferred(std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+Logger<DEBUG> doLogf(LogSite const &site, __FlashStringHelper const *fmt,
+                     Args &&...args) {
+  using Log = DeferredLogf<typename std::remove_reference<Args>::type...>;
+  return doLogf(std::integral_constant<bool, DEFERRED_LOGGING && Log::deferrable>(),
+                site, fmt, std::forward<Args>(args)...);
+}
+
 static inline Logger<DEBUG> noLog() { return {}; }
 
-#define LOG(...) \
-  (DEBUG ? doLog(F(__FILE__), __LINE__, __func__, ##__VA_ARGS__) : noLog())
-#define LOGF(...) \
-  (DEBUG ? doLogf(F(__FILE__), __LINE__, __func__, __VA_ARGS__) : noLog())
+/**
+ * Log at the given level (DEBUG, INFO, WARNING or ERROR). If the level is below
+ * the module's compile-time threshold, this expands to a constant false branch
+ * and the arguments are never evaluated. Otherwise, the runtime threshold costs
+ * one relaxed atomic load.
+ */
+#define LOG_AT(LEVEL, ...)                                  \
+  ((LogCompiledIn<LOG_LEVEL_##LEVEL, logModule>::value &&   \
+    logLevelEnabled(LOG_LEVEL_##LEVEL, logModule))          \
+       ? doLog(*LOG_SITE(LOG_LEVEL_##LEVEL), ##__VA_ARGS__) \
+       : noLog())
+#define LOGF_AT(LEVEL, ...)                                \
+  ((LogCompiledIn<LOG_LEVEL_##LEVEL, logModule>::value &&  \
+    logLevelEnabled(LOG_LEVEL_##LEVEL, logModule))         \
+       ? doLogf(*LOG_SITE(LOG_LEVEL_##LEVEL), __VA_ARGS__) \
+       : noLog())
+
+#define LOG(...) LOG_AT(INFO, ##__VA_ARGS__)
+#define LOGF(...) LOGF_AT(INFO, __VA_ARGS__)
@@ -1,25 +1,39 @@
 #pragma once
 
+#include <limits>
+
 // This code requires a new-ish version of GCC. Version 7.3.0 will do. If you
 // use platformio, you may need to customise platformio.ini to specify a later
 // version of toolchain-atmelavr. See the platformio.ini file in this repo for a
 // known-good version.
 
-template <int Rows, int Cols>
+/**
+ * One row of a Matrix. Defined outside of Matrix so that the number of rows can
+ * be deduced from an array of rows.
+ */
+template <int Cols, typename T = double>
+struct MatrixRow {
+  T elts[Cols];
+
+  constexpr T &operator[](int i) { return elts[i]; }
+  constexpr T const &operator[](int i) const { return elts[i]; }
+};
+
+/**
+ * Fixed-size matrix of T (double by default). Everything is constexpr, so
+ * models can be fitted at compile time.
+ */
+template <int Rows, int Cols, typename T = double>
 class Matrix {
  public:
   static_assert(Rows >= 1, "Matrix must have at least 1 row");
   static_assert(Cols >= 1, "Matrix must have at least 1 column");
 
-  struct Row {
-    double elts[Cols];
-
-    constexpr double &operator[](int i) { return elts[i]; }
-    constexpr double const &operator[](int i) const { return elts[i]; }
-  };
+  using Scalar = T;
+  using Row = MatrixRow<Cols, T>;
 
   constexpr Matrix(Row const (&data)[Rows] = {}) : data(data) {}
-  constexpr explicit Matrix(double x) : data{} {
+  constexpr explicit Matrix(T x) : data{} {
     for (int i = 0; i < Rows; ++i) {
       for (int j = 0; j < Cols; ++j) {
         data[i][j] = x;
@@ -30,8 +44,8 @@ class Matrix {
   constexpr Row &operator[](int i) { return data[i]; }
   constexpr Row const &operator[](int i) const { return data[i]; }
 
-  constexpr Matrix<Cols, Rows> transpose() const {
-    Matrix<Cols, Rows> res;
+  constexpr Matrix<Cols, Rows, T> transpose() const {
+    Matrix<Cols, Rows, T> res;
     for (int i = 0; i < Rows; ++i) {
       for (int j = 0; j < Cols; ++j) {
         res[j][i] = data[i][j];
@@ -41,8 +55,8 @@ class Matrix {
   }
 
   template <int FromRow, int FromCol, int OutRows, int OutCols>
-  constexpr Matrix<OutRows, OutCols> slice() const {
-    Matrix<OutRows, OutCols> r{};
+  constexpr Matrix<OutRows, OutCols, T> slice() const {
+    Matrix<OutRows, OutCols, T> r{};
     for (int i = FromRow; i < FromRow + OutRows; ++i) {
       for (int j = FromCol; j < FromCol + OutCols; ++j) {
         r[i - FromRow][j - FromCol] = data[i][j];
@@ -51,73 +65,142 @@ class Matrix {
     return r;
   }
 
+  /**
+   * Convert each element to U, e.g. to evaluate a model fitted in double with
+   * float arithmetic.
+   */
+  template <typename U>
+  constexpr Matrix<Rows, Cols, U> cast() const {
+    Matrix<Rows, Cols, U> r{};
+    for (int i = 0; i < Rows; ++i) {
+      for (int j = 0; j < Cols; ++j) {
+        r[i][j] = U(data[i][j]);
+      }
+    }
+    return r;
+  }
+
  private:
   Row data[Rows];
 };
 
-template <int n>
-constexpr Matrix<n, n> inverse(Matrix<n, n> const &m) {
-  Matrix<n * 2, n * 2> a;
-  for (int i = 0; i < n; i++) {
-    for (int j = 0; j < n; j++) {
-      a[i][j] = m[i][j];
-    }
-  }
+template <typename T>
+constexpr T absolute(T x) {
+  return x < 0 ? -x : x;
+}
 
-  // Initialising right-hand side to identity matrix.
+/**
+ * Result of solving a singular system. This is deliberately not constexpr, so
+ * that fitting a singular model at compile time fails to compile instead of
+ * producing NaNs.
+ */
+template <typename T>
+T singularMatrix() {
+  return std::numeric_limits<T>::quiet_NaN();
+}
+
+/**
+ * Gauss-Jordan elimination with partial pivoting. Prefer solveSymmetric() for
+ * solving systems of equations, which doesn't need the inverse.
+ */
+template <int n, typename T>
+constexpr Matrix<n, n, T> inverse(Matrix<n, n, T> const &m) {
+  Matrix<n, n, T> a = m;
+  Matrix<n, n, T> r{};
   for (int i = 0; i < n; ++i) {
-    for (int j = 0; j < 2 * n; ++j) {
-      if (j == i + n) {
-        a[i][j] = 1;
+    r[i][i] = 1;
+  }
+
+  for (int col = 0; col < n; ++col) {
+    // Pivot on the row with the largest element in this column.
+    int pivot = col;
+    for (int i = col + 1; i < n; ++i) {
+      if (absolute(a[i][col]) > absolute(a[pivot][col])) {
+        pivot = i;
       }
     }
-  }
+    if (a[pivot][col] == 0) {
+      return Matrix<n, n, T>(singularMatrix<T>());
+    }
+    if (pivot != col) {
+      auto const rowA = a[pivot];
+      a[pivot] = a[col];
+      a[col] = rowA;
+      auto const rowR = r[pivot];
+      r[pivot] = r[col];
+      r[col] = rowR;
+    }
 
-  // Partial pivoting.
-  for (int i = n; i > 1; --i) {
-    if (a[i - 1][1] < a[i][1]) {
-      for (int j = 0; j < 2 * n; ++j) {
-        double const d = a[i][j];
-        a[i][j] = a[i - 1][j];
-        a[i - 1][j] = d;
+    // Scale the pivot row to 1 and eliminate the column from all other rows.
+    T const d = a[col][col];
+    for (int j = 0; j < n; ++j) {
+      a[col][j] /= d;
+      r[col][j] /= d;
+    }
+    for (int i = 0; i < n; ++i) {
+      if (i != col) {
+        T const f = a[i][col];
+        for (int j = 0; j < n; ++j) {
+          a[i][j] -= f * a[col][j];
+          r[i][j] -= f * r[col][j];
+        }
       }
     }
   }
 
-  // Reducing to diagonal matrix.
-  for (int i = 0; i < n; ++i) {
-    for (int j = 0; j < 2 * n; ++j) {
-      if (j != i) {
-        double const d = a[j][i] / a[i][i];
-        for (int k = 0; k < n * 2; ++k) {
-          a[j][k] -= a[i][k] * d;
-        }
+  return r;
+}
+
+/**
+ * Solve A x = b for a symmetric positive definite A, e.g. the normal equations
+ * of a least squares problem. This uses the square root free LDLᵀ form of the
+ * Cholesky factorisation, which only reads the lower triangle of A, needs no
+ * pivoting, and takes about a sixth of the work of inverting A.
+ */
+template <int n, typename T>
+constexpr Matrix<n, 1, T> solveSymmetric(Matrix<n, n, T> const &A,
+                                         Matrix<n, 1, T> const &b) {
+  // Unit lower triangular L below the diagonal, D on the diagonal.
+  Matrix<n, n, T> L{};
+  for (int j = 0; j < n; ++j) {
+    T d = A[j][j];
+    for (int k = 0; k < j; ++k) {
+      d -= L[j][k] * L[j][k] * L[k][k];
+    }
+    if (!(d > 0)) {
+      return Matrix<n, 1, T>(singularMatrix<T>());
+    }
+    L[j][j] = d;
+    for (int i = j + 1; i < n; ++i) {
+      T s = A[i][j];
+      for (int k = 0; k < j; ++k) {
+        s -= L[i][k] * L[j][k] * L[k][k];
       }
+      L[i][j] = s / d;
     }
   }
 
-  // Reducing to unit matrix.
+  // Solve L z = b, then D w = z, then Lᵀ x = w.
+  Matrix<n, 1, T> x = b;
   for (int i = 0; i < n; ++i) {
-    double const d = a[i][i];
-    for (int j = 0; j < 2 * n; ++j) {
-      a[i][j] = a[i][j] / d;
+    for (int k = 0; k < i; ++k) {
+      x[i][0] -= L[i][k] * x[k][0];
     }
   }
-
-  // Result is in the right hand side.
-  Matrix<n, n> r{};
   for (int i = 0; i < n; ++i) {
-    for (int j = n; j < 2 * n; ++j) {
-      r[i][j - n] = a[i][j];
+    x[i][0] /= L[i][i];
+  }
+  for (int i = n - 1; i >= 0; --i) {
+    for (int k = i + 1; k < n; ++k) {
+      x[i][0] -= L[k][i] * x[k][0];
     }
   }
-
-  return r;
+  return x;
 }
 
-template <int Rows, int Cols>
-constexpr bool operator==(Matrix<Rows, Cols> const &lhs,
-                          Matrix<Rows, Cols> const &rhs) {
+template <int Rows, int Cols, typename T>
+constexpr bool operator==(Matrix<Rows, Cols, T> const &lhs,
+                          Matrix<Rows, Cols, T> const &rhs) {
   for (int i = 0; i < Rows; ++i) {
     for (int j = 0; j < Cols; ++j) {
       if (lhs[i][j] != rhs[i][j]) {
@@ -128,13 +211,13 @@ constexpr bool operator==(Matrix<Rows, Cols> const &lhs,
   return true;
 }
 
-template <int RowsL, int ColsL, int RowsR, int ColsR>
-constexpr Matrix<RowsL, ColsR> operator*(Matrix<RowsL, ColsL> const &lhs,
-                                         Matrix<RowsR, ColsR> const &rhs) {
+template <int RowsL, int ColsL, int RowsR, int ColsR, typename T>
+constexpr Matrix<RowsL, ColsR, T> operator*(
+    Matrix<RowsL, ColsL, T> const &lhs, Matrix<RowsR, ColsR, T> const &rhs) {
   static_assert(ColsL == RowsR,
                 "number of columns of first matrix must equal number of rows "
                 "of second matrix");
-  Matrix<RowsL, ColsR> mult{};
+  Matrix<RowsL, ColsR, T> mult{};
   for (int i = 0; i < RowsL; ++i) {
     for (int j = 0; j < ColsR; ++j) {
       for (int k = 0; k < ColsL; ++k) {
@@ -145,10 +228,10 @@ constexpr Matrix<RowsL, ColsR> operator*(Matrix<RowsL, ColsL> const &lhs,
   return mult;
 }
 
-template <int Rows, int ColsL, int ColsR>
-constexpr Matrix<Rows, ColsL + ColsR> hconcat(Matrix<Rows, ColsL> const &lhs,
-                                              Matrix<Rows, ColsR> const &rhs) {
-  Matrix<Rows, ColsL + ColsR> r;
+template <int Rows, int ColsL, int ColsR, typename T>
+constexpr Matrix<Rows, ColsL + ColsR, T> hconcat(
+    Matrix<Rows, ColsL, T> const &lhs, Matrix<Rows, ColsR, T> const &rhs) {
+  Matrix<Rows, ColsL + ColsR, T> r;
   for (int i = 0; i < Rows; ++i) {
     for (int j = 0; j < ColsL; ++j) {
       r[i][j] = lhs[i][j];
@@ -160,36 +243,143 @@ constexpr Matrix<Rows, ColsL + ColsR> hconcat(Matrix<Rows, ColsL> const &lhs,
   return r;
 }
 
-template <int Vars, int Eqs>
-constexpr Matrix<Vars, 1> ordinaryLeastSquares(Matrix<Eqs, Vars> const &X,
-                                               Matrix<Eqs, 1> const &y) {
-  return inverse(X.transpose() * X) * X.transpose() * y;
+/**
+ * Running sums of the normal equations XᵀX beta = Xᵀy of a least squares
+ * problem. Rows are folded in one at a time, so fitting takes O(rows * Vars²)
+ * time and constant memory, at compile time or at runtime.
+ */
+template <int Vars, typename T = double>
+class NormalEquations {
+  /**
+   * Only the lower triangle is used, since XᵀX is symmetric.
+   */
+  Matrix<Vars, Vars, T> XtX_;
+  Matrix<Vars, 1, T> Xty_;
+  int size_ = 0;
+
+ public:
+  constexpr NormalEquations() : XtX_{}, Xty_{} {}
+
+  /**
+   * Add one row x of X along with its value y. With weights, this solves the
+   * weighted least squares problem XᵀWX beta = XᵀWy instead.
+   */
+  constexpr void add(MatrixRow<Vars, T> const &x, T y, T weight = 1) {
+    for (int i = 0; i < Vars; ++i) {
+      T const wx = weight * x[i];
+      for (int j = 0; j <= i; ++j) {
+        XtX_[i][j] += wx * x[j];
+      }
+      Xty_[i][0] += wx * y;
+    }
+    ++size_;
+  }
+
+  /**
+   * The least squares solution for all rows added so far.
+   */
+  constexpr Matrix<Vars, 1, T> solve() const {
+    return solveSymmetric(XtX_, Xty_);
+  }
+
+  /**
+   * The full (symmetric) XᵀX.
+   */
+  constexpr Matrix<Vars, Vars, T> gram() const {
+    Matrix<Vars, Vars, T> r = XtX_;
+    for (int i = 0; i < Vars; ++i) {
+      for (int j = i + 1; j < Vars; ++j) {
+        r[i][j] = r[j][i];
+      }
+    }
+    return r;
+  }
+
+  constexpr int size() const { return size_; }
+};
+
+template <int Vars, int Eqs, typename T>
+constexpr Matrix<Vars, 1, T> ordinaryLeastSquares(Matrix<Eqs, Vars, T> const &X,
+                                                  Matrix<Eqs, 1, T> const &y) {
+  NormalEquations<Vars, T> normal;
+  for (int e = 0; e < Eqs; ++e) {
+    normal.add(X[e], y[e][0]);
+  }
+  return normal.solve();
 }
 
-template <int Vars>
+/**
+ * Linear model y = beta0 + beta1 x1 + ... fitted to a table of {x1, ..., y}
+ * rows.
+ *
+ * Fitting always happens in double (normally at compile time). The fitted beta
+ * is then narrowed to T, which is what the model is evaluated in at runtime.
+ * Use float on the ESP32, since its FPU doesn't do double.
+ */
+template <int Vars, typename T = double>
 class LinearFunction {
-  using Beta = Matrix<Vars + 1, 1>;
+ public:
+  static constexpr int VARS = Vars;
+
+  using Beta = Matrix<Vars + 1, 1, T>;
+
+  /**
+   * Accumulates {1, x1, ..., xn} rows for fitting.
+   */
+  using Fit = NormalEquations<Vars + 1>;
+
+  /**
+   * Add an {x1, ..., xn, y} row to fit, optionally weighted.
+   */
+  static constexpr void addRow(Fit &fit, MatrixRow<Vars + 1> const &eq,
+                               double weight = 1) {
+    MatrixRow<Vars + 1> x{};
+    x[0] = 1;
+    for (int i = 0; i < Vars; ++i) {
+      x[i + 1] = eq[i];
+    }
+    fit.add(x, eq[Vars], weight);
+  }
 
+  /**
+   * Accumulate all {x1, ..., xn, y} rows of a table.
+   */
   template <int Eqs>
-  static constexpr Beta compute(Matrix<Eqs, Vars + 1> const &m) {
-    auto const &X = m.template slice<0, 0, Eqs, Vars>();
-    auto const &y = m.template slice<0, Vars, Eqs, 1>();
-    return ordinaryLeastSquares(hconcat(Matrix<Eqs, 1>(1), X), y);
+  static constexpr Fit fit(MatrixRow<Vars + 1> const (&eqs)[Eqs]) {
+    Fit result;
+    for (auto const &eq : eqs) {
+      addRow(result, eq);
+    }
+    return result;
   }
 
- public:
   Beta beta;
 
   template <int Eqs>
-  constexpr LinearFunction(
-      typename Matrix<Eqs, Vars + 1>::Row const (&eqs)[Eqs])
-      : beta(compute(Matrix<Eqs, Vars + 1>(eqs))) {}
+  constexpr LinearFunction(MatrixRow<Vars + 1> const (&eqs)[Eqs])
+      : LinearFunction(fit(eqs)) {}
+
+  constexpr explicit LinearFunction(Beta const &beta) : beta(beta) {}
+
+  /**
+   * Fit to the rows accumulated in fit.
+   */
+  constexpr explicit LinearFunction(Fit const &fit)
+      : beta(fit.solve().template cast<T>()) {}
+
+  /**
+   * Narrow (or widen) a model fitted in another scalar type.
+   */
+  template <typename U>
+  constexpr explicit LinearFunction(LinearFunction<Vars, U> const &f)
+      : beta(f.beta.template cast<T>()) {}
 
   template <typename... Args>
-  constexpr double operator()(Args... args) const {
+  constexpr T operator()(Args... args) const {
     static_assert(sizeof...(args) == Vars,
                   "need exactly one function argument per variable");
-    Matrix<1, 1> const r = Matrix<1, Vars + 1>{{{1, double(args)...}}} * beta;
+    Matrix<1, 1, T> const r =
+        Matrix<1, Vars + 1, T>{{{T(1), T(args)...}}} * beta;
     return r[0][0];
   }
 };
@@ -202,10 +392,10 @@ static constexpr double roundBy(double x, double multiplier) {
   return roundToZero(x * multiplier) / multiplier;
 }
 
-template <int Rows, int Cols>
-constexpr Matrix<Rows, Cols> roundBy(Matrix<Rows, Cols> const &m,
-                                     int multiplier) {
-  Matrix<Rows, Cols> res = m;
+template <int Rows, int Cols, typename T>
+constexpr Matrix<Rows, Cols, T> roundBy(Matrix<Rows, Cols, T> const &m,
+                                        int multiplier) {
+  Matrix<Rows, Cols, T> res = m;
   for (int i = 0; i < Rows; ++i) {
     for (int j = 0; j < Cols; ++j) {
       res[i][j] = roundBy(res[i][j], multiplier);
@@ -217,17 +407,19 @@ constexpr Matrix<Rows, Cols> roundBy(Matrix<Rows, Cols> const &m,
 struct Print;
 
 void printMatrix(Print &out, int rows, int cols, double const *data);
+void printMatrix(Print &out, int rows, int cols, float const *data);
 
-template <int Rows, int Cols>
-Print &operator<<(Print &out, Matrix<Rows, Cols> const &m) {
+template <int Rows, int Cols, typename T>
+Print &operator<<(Print &out, Matrix<Rows, Cols, T> const &m) {
   printMatrix(out, Rows, Cols, &m[0][0]);
   return out;
 }
 
 void printLinearFunction(Print &out, int vars, double const *data);
+void printLinearFunction(Print &out, int vars, float const *data);
 
-template <int Vars>
-Print &operator<<(Print &out, LinearFunction<Vars> const &f) {
+template <int Vars, typename T>
+Print &operator<<(Print &out, LinearFunction<Vars, T> const &f) {
   printLinearFunction(out, Vars, &f.beta[0][0]);
   return out;
 }
@@ -3,6 +3,37 @@
 #include <Arduino.h>
 
 #include "homectl/Callback.h"
+#include "homectl/Event.h"
+#include "homectl/FrameCodec.h"
+
+/**
+ * Framing of the PMS5003T's UART protocol: 0x42 0x4D, the big-endian length of
+ * the rest of the frame, and the payload, which ends with the sum of all bytes
+ * before it.
+ */
+struct PMS5003TFraming : FramingDefaults {
+  static constexpr uint32_t SYNC = 0x424d;
+  static constexpr int SYNC_LEN = 2;
+  static constexpr int HEADER_LEN = 4;
+  /**
+   * Payload lengths of a measurement, and of the response to a sleep or mode
+   * command.
+   */
+  static constexpr int MEASUREMENT_LEN = 28;
+  static constexpr int COMMAND_RESPONSE_LEN = 4;
+  static constexpr int MAX_LEN = HEADER_LEN + MEASUREMENT_LEN;
+  static constexpr int CHECKSUM_LEN = 2;
+
+  static constexpr int frameLength(uint8_t const *header) {
+    int const len = readBigEndian<uint16_t>(header + 2);
+    return len == MEASUREMENT_LEN || len == COMMAND_RESPONSE_LEN
+               ? HEADER_LEN + len
+               : 0;
+  }
+  static constexpr uint16_t checksum(uint8_t const *frame, int len) {
+    return uint16_t(byteSum(frame, 0, len - CHECKSUM_LEN));
+  }
+};
 
 class PMS5003T {
   EV_OBJECT(PMS5003T)
@@ -27,47 +58,146 @@ class PMS5003T {
     uint16_t data13 = -1;
     uint16_t checksum = -1;
 
-    static uint16_t readU16(byte const *payload) {
-      return uint16_t(payload[0]) << 8 | payload[1];
-    }
-
     Reading() {}
 
-    explicit Reading(byte const (&payload)[28])
-        : pm1_0_std(readU16(&payload[0])),
-          pm2_5_std(readU16(&payload[2])),
-          pm10_std(readU16(&payload[4])),
-          pm1_0_atm(readU16(&payload[6])),
-          pm2_5_atm(readU16(&payload[8])),
-          pm10_atm(readU16(&payload[10])),
-          pm0_3_cnt(readU16(&payload[12])),
-          pm0_5_cnt(readU16(&payload[14])),
-          pm1_0_cnt(readU16(&payload[16])),
-          pm2_5_cnt(readU16(&payload[18])),
-          temp(readU16(&payload[20])),
-          hum(readU16(&payload[22])),
-          data13(readU16(&payload[24])),
-          checksum(readU16(&payload[26])) {}
+    /**
+     * Decode the PMS5003TFraming::MEASUREMENT_LEN bytes after the header.
+     */
+    explicit Reading(byte const *payload)
+        : pm1_0_std(readBigEndian<uint16_t>(&payload[0])),
+          pm2_5_std(readBigEndian<uint16_t>(&payload[2])),
+          pm10_std(readBigEndian<uint16_t>(&payload[4])),
+          pm1_0_atm(readBigEndian<uint16_t>(&payload[6])),
+          pm2_5_atm(readBigEndian<uint16_t>(&payload[8])),
+          pm10_atm(readBigEndian<uint16_t>(&payload[10])),
+          pm0_3_cnt(readBigEndian<uint16_t>(&payload[12])),
+          pm0_5_cnt(readBigEndian<uint16_t>(&payload[14])),
+          pm1_0_cnt(readBigEndian<uint16_t>(&payload[16])),
+          pm2_5_cnt(readBigEndian<uint16_t>(&payload[18])),
+          temp(readBigEndian<uint16_t>(&payload[20])),
+          hum(readBigEndian<uint16_t>(&payload[22])),
+          data13(readBigEndian<uint16_t>(&payload[24])),
+          checksum(readBigEndian<uint16_t>(&payload[26])) {}
 
     size_t printTo(Print &out) const;
   };
 
-  explicit PMS5003T(HardwareSerial &io);
-  void sleep(bool enabled);
+  enum Averaging {
+    AVERAGE_MEAN,
+    /**
+     * Each value is the median of the samples, so a single odd sample doesn't
+     * move it.
+     */
+    AVERAGE_MEDIAN,
+  };
+
+  /**
+   * When the sensor is woken up and sampled. The sensor is kept in passive
+   * mode, so it only sends a measurement when asked for one, and sleeps (with
+   * its fan off) between the last sample of a cycle and the next wake-up.
+   */
+  struct Schedule {
+    /**
+     * Time from one wake-up to the next.
+     */
+    unsigned long periodMs;
+    /**
+     * Time for the fan to get the air flowing after wake-up. The datasheet
+     * asks for at least 30 seconds before the readings are stable.
+     */
+    unsigned long warmUpMs;
+    /**
+     * Time between samples. The sensor updates its measurement about once a
+     * second, so less than that just gets the same sample again.
+     */
+    unsigned long settleMs;
+    /**
+     * Number of samples per reading, at most MAX_SAMPLES.
+     */
+    uint8_t samples;
+    Averaging averaging;
+  };
+
+  static constexpr int MAX_SAMPLES = 8;
+
+  /**
+   * A reading of 3 samples every 2 minutes, so the fan runs about a third of
+   * the time.
+   */
+  static constexpr Schedule DEFAULT_SCHEDULE = {2 * 60 * 1000, 30000, 2000, 3,
+                                                AVERAGE_MEDIAN};
+
+  /**
+   * Talk to the sensor through io, which must be set up at 9600 baud on RX_PIN
+   * and TX_PIN. Nothing is sent before the first loop().
+   */
+  explicit PMS5003T(Stream &io);
+  PMS5003T(Stream &io, Schedule const &schedule);
 
-  Callback<void(Reading const &)> newReading;
+  /**
+   * Takes effect from the next wake-up on.
+   */
+  void setSchedule(Schedule const &schedule);
+
+  /**
+   * Parse whatever the sensor sent since the last call. loop() doesn't do this
+   * by itself, so that it only needs to happen when bytes have arrived (see
+   * SerialPort::takeRxEvent()).
+   */
+  void receive();
+
+  /**
+   * Readings are posted here while parsing the sensor output, and passed on to
+   * the listeners by whoever calls newReading.dispatch().
+   */
+  EventChannel<Reading, 4, 3> newReading;
+
+  /**
+   * Ways in which the sensor output was garbled, counted since startup.
+   */
+  using Errors = FrameErrors;
+
+  Errors const &errors() const { return parser_.errors(); }
 
  private:
-  void sendSleep(bool enabled);
-
-  void processOutput();
-  void processInput();
-
-  HardwareSerial io_;
-  TimerHandle_t timer_;
-  enum SleepCommand {
-    SLEEP_NONE,
-    SLEEP_ENABLE,
-    SLEEP_DISABLE,
-  } sleepCommand_ = SLEEP_NONE;
+  /**
+   * Number of 16-bit values in a measurement, not counting its checksum.
+   */
+  static constexpr int FIELDS = PMS5003TFraming::MEASUREMENT_LEN / 2 - 1;
+
+  void sendCommand(byte command, uint16_t data);
+  void wake(unsigned long now);
+  void requestSample(unsigned long now);
+  void finishCycle(unsigned long now);
+  Reading average() const;
+
+  void handleFrame(byte const *frame, int len);
+  void handleSample(byte const *payload);
+
+  Stream &io_;
+  Schedule schedule_;
+
+  enum Phase {
+    PHASE_SLEEPING,
+    PHASE_WARMING_UP,
+    PHASE_SAMPLING,
+  } phase_ = PHASE_SLEEPING;
+  /**
+   * When the current phase ends (or, while sampling, when the next sample is
+   * due), in millis().
+   */
+  unsigned long deadline_;
+  unsigned long cycleStart_ = 0;
+  /**
+   * Whether we asked for a sample, and it didn't come yet.
+   */
+  bool awaitingSample_ = false;
+  uint8_t requests_ = 0;
+  uint8_t sampleCount_ = 0;
+  /**
+   * The raw values of the samples of this cycle.
+   */
+  uint16_t samples_[MAX_SAMPLES][FIELDS];
+
+  FrameParser<PMS5003TFraming> parser_;
 };
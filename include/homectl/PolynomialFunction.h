@@ -0,0 +1,117 @@
+#pragma once
+
+#include "homectl/Matrix.h"
+
+/**
+ * Number of monomials of Vars variables with total degree up to Degree.
+ */
+constexpr int polynomialTerms(int vars, int degree) {
+  if (vars == 0) {
+    return 1;
+  }
+  int terms = 0;
+  for (int e = 0; e <= degree; ++e) {
+    terms += polynomialTerms(vars - 1, degree - e);
+  }
+  return terms;
+}
+
+/**
+ * Polynomial model of total degree Degree in Vars variables, including all
+ * interaction terms (e.g. 1, x1, x2, x1², x1 x2, x2² for Vars = Degree = 2),
+ * fitted by least squares to a table of {x1, ..., xn, y} rows.
+ *
+ * Like LinearFunction, fitting happens in double, and the coefficients are then
+ * narrowed to T, which is all the object holds. Coefficients are ordered so that
+ * evaluation is a nested Horner scheme: the polynomial in x1 whose coefficients
+ * are polynomials in x2, ..., with the highest power first.
+ */
+template <int Vars, int Degree, typename T = double>
+class PolynomialFunction {
+ public:
+  static constexpr int VARS = Vars;
+  static constexpr int TERMS = polynomialTerms(Vars, Degree);
+
+  using Fit = NormalEquations<TERMS>;
+
+ private:
+  /**
+   * Write the monomials of x[var...] with total degree up to degree, times
+   * prefix, to terms[i...], in coefficient order.
+   */
+  template <typename U>
+  static constexpr void expand(U const *x, int var, int degree, U prefix,
+                               U *terms, int &i) {
+    if (var == Vars) {
+      terms[i++] = prefix;
+      return;
+    }
+    for (int e = degree; e >= 0; --e) {
+      U power = prefix;
+      for (int k = 0; k < e; ++k) {
+        power *= x[var];
+      }
+      expand(x, var + 1, degree - e, power, terms, i);
+    }
+  }
+
+  /**
+   * Evaluate the part of the polynomial in x[var...] with total degree up to
+   * degree, whose coefficients start at beta[i].
+   */
+  constexpr T evaluate(T const *x, int var, int degree, int &i) const {
+    if (var == Vars) {
+      return beta[i++][0];
+    }
+    T r = 0;
+    for (int e = degree; e >= 0; --e) {
+      r = r * x[var] + evaluate(x, var + 1, degree - e, i);
+    }
+    return r;
+  }
+
+ public:
+  /**
+   * Add an {x1, ..., xn, y} row to fit, optionally weighted.
+   */
+  static constexpr void addRow(Fit &fit, MatrixRow<Vars + 1> const &eq,
+                               double weight = 1) {
+    MatrixRow<TERMS> terms{};
+    int i = 0;
+    expand(eq.elts, 0, Degree, 1.0, terms.elts, i);
+    fit.add(terms, eq[Vars], weight);
+  }
+
+  /**
+   * Accumulate all {x1, ..., xn, y} rows of a table.
+   */
+  template <int Eqs>
+  static constexpr Fit fit(MatrixRow<Vars + 1> const (&eqs)[Eqs]) {
+    Fit result;
+    for (auto const &eq : eqs) {
+      addRow(result, eq);
+    }
+    return result;
+  }
+
+  Matrix<TERMS, 1, T> beta;
+
+  template <int Eqs>
+  constexpr PolynomialFunction(MatrixRow<Vars + 1> const (&eqs)[Eqs])
+      : PolynomialFunction(fit(eqs)) {}
+
+  /**
+   * Fit to the rows accumulated in fit.
+   */
+  constexpr explicit PolynomialFunction(Fit const &fit)
+      : beta(fit.solve().template cast<T>()) {}
+
+  template <typename... Args>
+  constexpr T operator()(Args... args) const {
+    static_assert(sizeof...(args) == Vars,
+                  "need exactly one function argument per variable");
+    T const x[Vars] = {T(args)...};
+    int i = 0;
+    return evaluate(x, 0, Degree, i);
+  }
+};
@@ -36,7 +36,15 @@ Print &operator<<(Print &out, Arg const &arg) {
   return out;
 }
 
+/**
+ * On the ESP32, flash is memory-mapped, so flash strings can be read directly
+ * without copying them into a String first.
+ */
+static inline char const *flashString(__FlashStringHelper const *str) {
+  return reinterpret_cast<char const *>(str);
+}
+
 static inline Print &operator<<(Print &out, __FlashStringHelper const *arg) {
-  out.print(String(arg));
+  out.print(flashString(arg));
   return out;
 }
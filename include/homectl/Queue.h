@@ -1,43 +1,188 @@
 #pragma once
 
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
 #include <initializer_list>
 #include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Storage for one Queue element, left uninitialised until an element is put
+ * there.
+ */
+template <typename T, bool = std::is_trivially_destructible<T>::value>
+union QueueSlot {
+  struct Empty {};
+
+  constexpr QueueSlot() : empty() {}
+  constexpr QueueSlot(T &&v) : value(std::move(v)) {}
+
+  Empty empty;
+  T value;
+};
+
+template <typename T>
+union QueueSlot<T, false> {
+  struct Empty {};
+
+  QueueSlot() : empty() {}
+  ~QueueSlot() {}
+
+  Empty empty;
+  T value;
+};
+
+/**
+ * The slots and indices of a Queue. Trivially destructible elements don't need
+ * to be destroyed, which keeps such queues usable in constant expressions.
+ */
+template <typename T, int Capacity,
+          bool = std::is_trivially_destructible<T>::value>
+class QueueStorage {
+ protected:
+  constexpr QueueStorage() : data_{} {}
+
+  constexpr void destroy(int slot) {}
+
+  QueueSlot<T> data_[Capacity];
+  int head_ = 0;
+  int size_ = 0;
+};
+
+template <typename T, int Capacity>
+class QueueStorage<T, Capacity, false> {
+ protected:
+  QueueStorage() {}
+  ~QueueStorage() {
+    for (int i = 0; i < size_; ++i) {
+      destroy((head_ + i) % Capacity);
+    }
+  }
+
+  void destroy(int slot) { data_[slot].value.~T(); }
+
+  QueueSlot<T> data_[Capacity];
+  int head_ = 0;
+  int size_ = 0;
+};
 
+/**
+ * Fixed-capacity FIFO ring buffer. Slots are only constructed when an element
+ * is pushed and destroyed when it is popped, so moving or draining k elements
+ * costs O(k) regardless of Capacity.
+ *
+ * Trivially copyable elements are written by assigning a whole slot, which
+ * (unlike placement new) is allowed in constant expressions.
+ */
 template <typename T, int Capacity>
-class Queue {
+class Queue : private QueueStorage<T, Capacity> {
+  static_assert(Capacity >= 1, "Queue must have at least 1 slot");
+
+  using QueueStorage<T, Capacity>::data_;
+  using QueueStorage<T, Capacity>::head_;
+  using QueueStorage<T, Capacity>::size_;
+
+  static constexpr int slot(int i) { return i < Capacity ? i : i - Capacity; }
+
+  constexpr void construct(int slot, T &&value, std::true_type) {
+    data_[slot] = QueueSlot<T>(std::move(value));
+  }
+  void construct(int slot, T &&value, std::false_type) {
+    new (&data_[slot].value) T(std::move(value));
+  }
+
  public:
-  constexpr Queue() : data_{}, end_(data_) {}
+  class const_iterator {
+    Queue const *queue_;
+    int i_;
+
+   public:
+    constexpr const_iterator(Queue const *queue, int i)
+        : queue_(queue), i_(i) {}
+
+    constexpr T const &operator*() const {
+      return queue_->data_[slot(queue_->head_ + i_)].value;
+    }
+    constexpr const_iterator &operator++() {
+      ++i_;
+      return *this;
+    }
+    constexpr bool operator!=(const_iterator const &rhs) const {
+      return i_ != rhs.i_;
+    }
+  };
+
+  constexpr Queue() {}
   constexpr Queue(std::initializer_list<T> init) : Queue() {
     for (T v : init) {
-      add(std::move(v));  // ignores failures
-    }
-  }
-  constexpr Queue(Queue &&rhs) : data_{}, end_(data_) {
-    for (T &v : rhs.data_) {
-      add(std::move(v));
+      push(std::move(v));  // ignores failures
     }
-    rhs.clear();
   }
+  constexpr Queue(Queue &&rhs) : Queue() { rhs.drain_into(*this); }
 
-  constexpr bool add(T &&value) {
-    if (end_ == data_ + Capacity) {
+  /**
+   * Append value at the back. Returns false if the queue is full.
+   */
+  constexpr bool push(T &&value) {
+    if (size_ == Capacity) {
       return false;
     }
-    *end_ = std::move(value);
-    ++end_;
+    construct(slot(head_ + size_), std::move(value),
+              std::is_trivially_copyable<T>());
+    ++size_;
     return true;
   }
 
-  constexpr void clear() { end_ = data_; }
+  /**
+   * Same as push().
+   */
+  constexpr bool add(T &&value) { return push(std::move(value)); }
 
-  constexpr int size() const { return end() - begin(); }
+  /**
+   * The oldest element. The queue must not be empty.
+   */
+  constexpr T &front() { return data_[head_].value; }
+  constexpr T const &front() const { return data_[head_].value; }
 
-  constexpr T const *begin() const { return data_; }
-  constexpr T const *end() const { return end_; }
+  /**
+   * Remove the oldest element. The queue must not be empty.
+   */
+  constexpr void pop() {
+    this->destroy(head_);
+    head_ = slot(head_ + 1);
+    --size_;
+  }
 
- private:
-  T data_[Capacity];
-  T *end_;
+  /**
+   * Move elements from the front of this queue to the back of out, until
+   * either this queue is empty or out is full. Returns the number of elements
+   * moved.
+   */
+  template <int N>
+  constexpr int drain_into(Queue<T, N> &out) {
+    int moved = 0;
+    while (size_ != 0 && out.push(std::move(front()))) {
+      pop();
+      ++moved;
+    }
+    return moved;
+  }
+
+  constexpr void clear() {
+    while (size_ != 0) {
+      pop();
+    }
+  }
+
+  constexpr int size() const { return size_; }
+  constexpr bool empty() const { return size_ == 0; }
+
+  constexpr const_iterator begin() const { return {this, 0}; }
+  constexpr const_iterator end() const { return {this, size_}; }
 };
 
 template <typename T, int Capacity>
@@ -60,7 +205,303 @@ class ThreadSafeQueue {
     return std::move(queue_);
   }
 
+  /**
+   * Move as many elements as fit into out, holding the lock only for as long
+   * as that takes.
+   */
+  template <int N>
+  int drain_into(Queue<T, N> &out) {
+    Lock const guard(mtx_);
+    return queue_.drain_into(out);
+  }
+
  private:
   Queue<T, Capacity> queue_;
   std::mutex mtx_;
 };
+
+/**
+ * Lock-free single-producer/single-consumer ring buffer.
+ *
+ * Exactly one task may call the producer functions (reserve/commit) and
+ * exactly one other task may call the consumer functions (front/pop). The
+ * producer fills a slot in place and then publishes it with a release store;
+ * the consumer reads it in place after an acquire load, so elements are never
+ * copied in or out of the ring.
+ *
+ * Indices run from 0 to 2 * Capacity - 1 so that a full ring can be told apart
+ * from an empty one without sacrificing a slot.
+ */
+template <typename T, int Capacity>
+class SpscQueue {
+  static_assert(Capacity >= 1, "SpscQueue must have at least 1 slot");
+
+  static constexpr int next(int i) { return i + 1 == Capacity * 2 ? 0 : i + 1; }
+  static constexpr int slot(int i) { return i < Capacity ? i : i - Capacity; }
+  static constexpr int distance(int head, int tail) {
+    return head >= tail ? head - tail : head + Capacity * 2 - tail;
+  }
+
+ public:
+  /**
+   * Producer: return the slot the next element should be written to, or
+   * nullptr if the ring is full. Calling reserve() again before commit()
+   * returns the same slot.
+   */
+  T *reserve() {
+    int const head = head_.load(std::memory_order_relaxed);
+    int const tail = tail_.load(std::memory_order_acquire);
+    if (distance(head, tail) == Capacity) {
+      return nullptr;
+    }
+    return &data_[slot(head)];
+  }
+
+  /**
+   * Producer: publish the slot returned by the last reserve() to the consumer.
+   */
+  void commit() {
+    int const head = head_.load(std::memory_order_relaxed);
+    head_.store(next(head), std::memory_order_release);
+  }
+
+  /**
+   * Producer: copy or move a value into the ring. Returns false if it's full.
+   */
+  bool add(T &&value) {
+    T *const p = reserve();
+    if (p == nullptr) {
+      return false;
+    }
+    *p = std::move(value);
+    commit();
+    return true;
+  }
+
+  /**
+   * Consumer: return the oldest committed element, or nullptr if the ring is
+   * empty. The element stays valid until pop() is called.
+   */
+  T *front() {
+    int const tail = tail_.load(std::memory_order_relaxed);
+    int const head = head_.load(std::memory_order_acquire);
+    if (head == tail) {
+      return nullptr;
+    }
+    return &data_[slot(tail)];
+  }
+
+  /**
+   * Consumer: release the element returned by front() back to the producer.
+   */
+  void pop() {
+    int const tail = tail_.load(std::memory_order_relaxed);
+    tail_.store(next(tail), std::memory_order_release);
+  }
+
+  /**
+   * Number of committed elements. Only a snapshot if called while the other
+   * side is active.
+   */
+  int size() const {
+    return distance(head_.load(std::memory_order_acquire),
+                    tail_.load(std::memory_order_acquire));
+  }
+
+ private:
+  T data_[Capacity];
+  std::atomic<int> head_{0};
+  std::atomic<int> tail_{0};
+};
+
+/**
+ * Lock-free single-producer/single-consumer queue of variable-length byte
+ * records, packed into one contiguous arena of Size bytes.
+ *
+ * Each record is stored as a 2 byte little-endian length followed by its
+ * payload. Records are always contiguous in the arena, so the consumer can hand
+ * out a pointer to the payload directly. If the producer runs into the end of
+ * the arena while writing a record, it moves the partial record to the start
+ * of the arena and leaves a wrap marker behind.
+ *
+ * The producer doesn't need to know the record length up front: it calls
+ * begin(), then put() for each byte, then commit(). Until commit(), the record
+ * is invisible to the consumer. One byte of the arena is always left unused so
+ * that a full arena can be told apart from an empty one.
+ *
+ * Since records are contiguous, only records of up to (Size - 1) / 2 bytes
+ * including the header are guaranteed to fit once the consumer has caught up.
+ */
+template <int Size>
+class RecordQueue {
+  static_assert(Size > 4 && Size < 0xFFFF, "unsupported RecordQueue size");
+
+  static constexpr int HEADER = 2;
+  static constexpr uint16_t WRAP = 0xFFFF;
+
+ public:
+  /**
+   * Producer-side state of the record currently being written.
+   */
+  struct Writer {
+    uint16_t start;
+    uint16_t pos;
+    bool valid;
+
+    /**
+     * Number of payload bytes written so far.
+     */
+    int size() const { return valid ? pos - start - HEADER : 0; }
+  };
+
+  /**
+   * A committed record, as seen by the consumer.
+   */
+  struct Entry {
+    uint8_t const *data;
+    uint16_t size;
+  };
+
+  /**
+   * Producer: start a new record. The returned writer is invalid if there is
+   * no space left for even an empty record.
+   */
+  Writer begin() {
+    uint16_t const head = head_.load(std::memory_order_relaxed);
+    Writer w{head, head, true};
+    uint8_t const header[HEADER] = {};
+    w.valid = put(w, header, HEADER);
+    return w;
+  }
+
+  /**
+   * Producer: append a byte to the record. Returns false (and leaves the record
+   * unchanged) if the arena is full.
+   */
+  bool put(Writer &w, uint8_t b) { return put(w, &b, 1); }
+
+  /**
+   * Producer: append n bytes to the record. Either all bytes are appended or,
+   * if they don't fit, none are and false is returned.
+   */
+  bool put(Writer &w, void const *src, int n) {
+    if (!w.valid) {
+      return false;
+    }
+    uint16_t const tail = tail_.load(std::memory_order_acquire);
+    if (n > available(w, tail)) {
+      // Only if the consumer is behind us can there be more space at the start
+      // of the arena.
+      if (tail > w.pos || !wrap(w, tail) || n > available(w, tail)) {
+        return false;
+      }
+    }
+    memcpy(&data_[w.pos], src, n);
+    w.pos += n;
+    return true;
+  }
+
+  /**
+   * Producer: publish the record to the consumer.
+   */
+  void commit(Writer &w) {
+    if (!w.valid) {
+      return;
+    }
+    uint16_t const len = w.size();
+    data_[w.start] = len & 0xFF;
+    data_[w.start + 1] = len >> 8;
+    head_.store(w.pos == Size ? 0 : w.pos, std::memory_order_release);
+    w.valid = false;
+  }
+
+  /**
+   * Consumer: return the oldest committed record, or an entry with a null data
+   * pointer if the queue is empty. The entry stays valid until pop().
+   */
+  Entry front() {
+    uint16_t tail = tail_.load(std::memory_order_relaxed);
+    uint16_t const head = head_.load(std::memory_order_acquire);
+    if (head != tail && isWrap(tail)) {
+      tail = 0;
+      tail_.store(tail, std::memory_order_release);
+    }
+    if (head == tail) {
+      return {nullptr, 0};
+    }
+    return {&data_[tail + HEADER], readLength(tail)};
+  }
+
+  /**
+   * Consumer: release the record returned by front().
+   */
+  void pop() {
+    uint16_t const tail = tail_.load(std::memory_order_relaxed);
+    uint16_t const next = tail + HEADER + readLength(tail);
+    tail_.store(next == Size ? 0 : next, std::memory_order_release);
+  }
+
+  /**
+   * Whether there are no committed records. Only a snapshot if called while
+   * the other side is active.
+   */
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Number of bytes taken by committed records, including headers and any
+   * space skipped at the end of the arena. Only a snapshot if called while the
+   * other side is active.
+   */
+  int used() const {
+    int const head = head_.load(std::memory_order_acquire);
+    int const tail = tail_.load(std::memory_order_acquire);
+    return head >= tail ? head - tail : head + Size - tail;
+  }
+
+ private:
+  uint16_t readLength(uint16_t at) const {
+    return data_[at] | uint16_t(data_[at + 1]) << 8;
+  }
+
+  bool isWrap(uint16_t at) const {
+    return at + HEADER > Size || readLength(at) == WRAP;
+  }
+
+  /**
+   * Number of contiguous bytes that can be appended at w.pos. We need to keep
+   * at least one byte between us and the tail.
+   */
+  static int available(Writer const &w, uint16_t tail) {
+    if (tail > w.pos) {
+      return tail - w.pos - 1;
+    }
+    return Size - w.pos - (tail == 0 ? 1 : 0);
+  }
+
+  /**
+   * Move the partial record in w to the start of the arena, if the consumer
+   * has freed enough space there.
+   */
+  bool wrap(Writer &w, uint16_t tail) {
+    uint16_t const len = w.pos - w.start;
+    // The consumer is somewhere in [0, start], so [0, tail) is free.
+    if (tail <= len) {
+      return false;
+    }
+    memcpy(data_, data_ + w.start, len);
+    if (w.start + HEADER <= Size) {
+      data_[w.start] = WRAP & 0xFF;
+      data_[w.start + 1] = WRAP >> 8;
+    }
+    w.start = 0;
+    w.pos = len;
+    return true;
+  }
+
+  uint8_t data_[Size];
+  std::atomic<uint16_t> head_{0};
+  std::atomic<uint16_t> tail_{0};
+};
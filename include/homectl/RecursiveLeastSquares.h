@@ -0,0 +1,108 @@
+#pragma once
+
+#include "homectl/Matrix.h"
+
+/**
+ * Incrementally updated linear model y = beta0 + beta1 x1 + ..., for
+ * recalibrating a LinearFunction on the device as new reference samples come
+ * in.
+ *
+ * Each update() costs O(Vars²) and needs no matrix inversion. Older samples are
+ * weighted down by a factor lambda per update (lambda = 1 weighs all samples
+ * equally), so the model follows slow drift of the sensor.
+ *
+ * The whole state is beta and the (Vars + 1)² covariance matrix P, which is
+ * small enough to persist.
+ */
+template <int Vars, typename T = float>
+class RecursiveLeastSquares {
+ public:
+  using Beta = Matrix<Vars + 1, 1, T>;
+  using Covariance = Matrix<Vars + 1, Vars + 1, T>;
+
+  struct State {
+    Beta beta;
+    Covariance P;
+  };
+
+ private:
+  State state_;
+  T lambda_;
+
+ public:
+  /**
+   * Start out knowing nothing. Larger delta lets the first samples move beta
+   * more.
+   */
+  constexpr RecursiveLeastSquares(T lambda, T delta)
+      : state_{Beta{}, Covariance{}}, lambda_(lambda) {
+    for (int i = 0; i < Vars + 1; ++i) {
+      state_.P[i][i] = delta;
+    }
+  }
+
+  /**
+   * Start out from a batch fit, as if all of its rows had been passed to
+   * update() with lambda = 1.
+   */
+  constexpr RecursiveLeastSquares(
+      typename LinearFunction<Vars>::Fit const &fit, T lambda)
+      : state_{fit.solve().template cast<T>(),
+               inverse(fit.gram()).template cast<T>()},
+        lambda_(lambda) {}
+
+  /**
+   * Continue from a previously saved state.
+   */
+  constexpr RecursiveLeastSquares(State const &state, T lambda)
+      : state_(state), lambda_(lambda) {}
+
+  /**
+   * Add a sample {x1, ..., xn, y}.
+   */
+  constexpr void update(MatrixRow<Vars + 1, T> const &eq) {
+    constexpr int n = Vars + 1;
+    MatrixRow<n, T> x{};
+    x[0] = 1;
+    for (int i = 0; i < Vars; ++i) {
+      x[i + 1] = eq[i];
+    }
+
+    // Gain k = P x / (lambda + xᵀ P x).
+    MatrixRow<n, T> Px{};
+    T denom = lambda_;
+    T error = eq[Vars];
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < n; ++j) {
+        Px[i] += state_.P[i][j] * x[j];
+      }
+      denom += x[i] * Px[i];
+      error -= x[i] * state_.beta[i][0];
+    }
+
+    for (int i = 0; i < n; ++i) {
+      state_.beta[i][0] += Px[i] / denom * error;
+    }
+
+    // P = (P - k xᵀ P) / lambda. Compute one triangle and mirror it, so that
+    // rounding errors don't make P drift away from symmetric.
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j <= i; ++j) {
+        T const p = (state_.P[i][j] - Px[i] * Px[j] / denom) / lambda_;
+        state_.P[i][j] = p;
+        state_.P[j][i] = p;
+      }
+    }
+  }
+
+  template <typename... Args>
+  constexpr T operator()(Args... args) const {
+    return function()(args...);
+  }
+
+  constexpr LinearFunction<Vars, T> function() const {
+    return LinearFunction<Vars, T>(state_.beta);
+  }
+
+  constexpr State const &state() const { return state_; }
+};
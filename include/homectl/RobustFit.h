@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+#include "homectl/Matrix.h"
+
+/**
+ * How iteratively reweighted least squares weighs down rows with large
+ * residuals.
+ */
+enum RobustLoss {
+  /**
+   * Rows with residuals beyond 1.345 standard deviations get weights inversely
+   * proportional to their residual, so outliers still count, but less.
+   */
+  ROBUST_HUBER,
+  /**
+   * Tukey's biweight: rows with residuals beyond 4.685 standard deviations are
+   * ignored entirely.
+   */
+  ROBUST_TUKEY,
+};
+
+constexpr double robustWeight(RobustLoss loss, double u) {
+  switch (loss) {
+    case ROBUST_HUBER: {
+      constexpr double c = 1.345;
+      return absolute(u) <= c ? 1 : c / absolute(u);
+    }
+    case ROBUST_TUKEY: {
+      constexpr double c = 4.685;
+      double const t = u / c;
+      return absolute(t) < 1 ? (1 - t * t) * (1 - t * t) : 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Median of v[0..n), reordering v. For even n, this is the upper of the two
+ * middle values.
+ */
+constexpr double medianInPlace(double *v, int n) {
+  int const k = n / 2;
+  int lo = 0;
+  int hi = n - 1;
+  while (lo < hi) {
+    double const pivot = v[(lo + hi) / 2];
+    int i = lo;
+    int j = hi;
+    while (i <= j) {
+      while (v[i] < pivot) ++i;
+      while (v[j] > pivot) --j;
+      if (i <= j) {
+        double const t = v[i];
+        v[i] = v[j];
+        v[j] = t;
+        ++i;
+        --j;
+      }
+    }
+    if (k <= j) {
+      hi = j;
+    } else if (k >= i) {
+      lo = i;
+    } else {
+      break;
+    }
+  }
+  return v[k];
+}
+
+template <typename Model, int Vars, std::size_t... I>
+constexpr double evaluateRow(Model const &model, MatrixRow<Vars + 1> const &eq,
+                             std::index_sequence<I...>) {
+  return model(eq[I]...);
+}
+
+template <typename Model, int Vars>
+constexpr double residual(Model const &model, MatrixRow<Vars + 1> const &eq) {
+  return eq[Vars] -
+         evaluateRow<Model, Vars>(model, eq, std::make_index_sequence<Vars>());
+}
+
+template <int n>
+constexpr bool converged(Matrix<n, 1> const &prev, Matrix<n, 1> const &next) {
+  for (int i = 0; i < n; ++i) {
+    double const tolerance = 1e-9 * (absolute(prev[i][0]) + 1);
+    if (absolute(next[i][0] - prev[i][0]) > tolerance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Largest table for which robustFit() keeps its scratch space on the stack
+ * (1 KiB). Larger tables, e.g. reference logs fitted at runtime, need to pass
+ * their own.
+ */
+constexpr int ROBUST_FIT_STACK_ROWS = 128;
+
+/**
+ * Fit a model (LinearFunction or PolynomialFunction) to a table of {x1, ...,
+ * xn, y} rows with iteratively reweighted least squares, so that a few bad rows
+ * don't skew the result.
+ *
+ * Starting from the ordinary least squares fit, each iteration weighs the rows
+ * by their residual relative to the robust scale estimate (the median absolute
+ * residual), and refits. This stops after maxIterations, or once the
+ * coefficients no longer change. Works at compile time and at runtime; each
+ * iteration costs two passes over the table, and absResiduals is the only
+ * memory it needs per row.
+ *
+ * Returns the final weighted normal equations, from which Model (or a
+ * RecursiveLeastSquares) can be constructed.
+ */
+template <typename Model, int Eqs>
+constexpr typename Model::Fit robustFit(
+    MatrixRow<Model::VARS + 1> const (&eqs)[Eqs], RobustLoss loss,
+    double (&absResiduals)[Eqs], int maxIterations = 20) {
+  constexpr int Vars = Model::VARS;
+  using Fit = typename Model::Fit;
+
+  Fit fit = Model::fit(eqs);
+  auto beta = fit.solve();
+  for (int iteration = 0; iteration < maxIterations; ++iteration) {
+    Model const model(fit);
+    for (int e = 0; e < Eqs; ++e) {
+      absResiduals[e] = absolute(residual<Model, Vars>(model, eqs[e]));
+    }
+
+    // Scale of the residuals of the good rows; 0.6745 makes it an estimate of
+    // the standard deviation for normally distributed residuals.
+    double const scale = medianInPlace(absResiduals, Eqs) / 0.6745;
+    if (scale == 0) {
+      break;
+    }
+
+    // The median reordered absResiduals, so compute the residuals again.
+    Fit weighted;
+    for (int e = 0; e < Eqs; ++e) {
+      Model::addRow(
+          weighted, eqs[e],
+          robustWeight(loss, residual<Model, Vars>(model, eqs[e]) / scale));
+    }
+    auto const next = weighted.solve();
+    fit = weighted;
+    if (converged(beta, next)) {
+      break;
+    }
+    beta = next;
+  }
+  return fit;
+}
+
+/**
+ * robustFit() for tables of up to ROBUST_FIT_STACK_ROWS rows, such as the
+ * compile-time calibration tables.
+ */
+template <typename Model, int Eqs>
+constexpr typename Model::Fit robustFit(
+    MatrixRow<Model::VARS + 1> const (&eqs)[Eqs], RobustLoss loss,
+    int maxIterations = 20) {
+  static_assert(Eqs <= ROBUST_FIT_STACK_ROWS,
+                "table too large for the stack; pass absResiduals");
+  double absResiduals[Eqs] = {};
+  return robustFit<Model>(eqs, loss, absResiduals, maxIterations);
+}
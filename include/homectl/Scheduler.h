@@ -0,0 +1,164 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "homectl/Callback.h"
+
+/**
+ * Whether millis() has reached the deadline, also when millis() wrapped around
+ * in between (every 49 days).
+ */
+constexpr bool deadlinePassed(uint32_t now, uint32_t deadline) {
+  return int32_t(now - deadline) >= 0;
+}
+
+/**
+ * Clock for Scheduler on the ESP32: millis(), and sleeping on a FreeRTOS task
+ * notification, so that wake() from another task ends the sleep early.
+ */
+class TaskClock {
+ public:
+  /**
+   * Must be called from the task that will sleep().
+   */
+  void begin();
+
+  uint32_t now() const { return millis(); }
+  /**
+   * Block until ms have passed (forever if ms is UINT32_MAX), or until wake().
+   */
+  void sleep(uint32_t ms);
+  void wake();
+
+ private:
+  TaskHandle_t task_ = nullptr;
+};
+
+/**
+ * Runs up to Tasks tasks on one FreeRTOS task, each when its deadline passes
+ * or when something notifies it, and sleeps in between. The tasks are stored
+ * inline, so the scheduler never allocates.
+ *
+ * Tasks are identified by the caller's own numbering, from 0 to Tasks - 1.
+ * Everything but notify() must be called from the task that runs loop().
+ */
+template <int Tasks, typename Clock = TaskClock>
+class Scheduler {
+ public:
+  static constexpr uint32_t FOREVER = UINT32_MAX;
+
+  /**
+   * Run object.Method() every periodMs, starting with the next loop(). The
+   * period counts from deadline to deadline, so it doesn't drift with the
+   * time the tasks take.
+   */
+  template <typename Object, void (Object::*Method)()>
+  void every(int task, Object &object, uint32_t periodMs) {
+    on<Object, Method>(task, object);
+    tasks_[task].period = periodMs;
+    at(task, clock_.now());
+  }
+
+  /**
+   * Run object.Method() only when notified, or at a deadline set with at() or
+   * after().
+   */
+  template <typename Object, void (Object::*Method)()>
+  void on(int task, Object &object) {
+    tasks_[task].run.template listen<Object, Method>(object).listen();
+    tasks_[task].period = 0;
+    tasks_[task].armed = false;
+  }
+
+  /**
+   * Run the task once at millis() == deadline, replacing any earlier deadline.
+   * A periodic task continues its period from there.
+   */
+  void at(int task, uint32_t deadline) {
+    tasks_[task].deadline = deadline;
+    tasks_[task].armed = true;
+  }
+
+  void after(int task, uint32_t delayMs) {
+    at(task, clock_.now() + delayMs);
+  }
+
+  void cancel(int task) { tasks_[task].armed = false; }
+
+  /**
+   * Run the task in the next loop(), and wake up loop() if it's sleeping. Safe
+   * to call from any task.
+   */
+  void notify(int task) {
+    tasks_[task].ready.store(true, std::memory_order_release);
+    clock_.wake();
+  }
+
+  /**
+   * Run the tasks that are due or notified, in order of their numbers. Returns
+   * the number of ms until the next deadline, or FOREVER.
+   */
+  uint32_t runDue() {
+    uint32_t now = clock_.now();
+    for (Task &task : tasks_) {
+      bool const ready = task.ready.exchange(false, std::memory_order_acquire);
+      bool const due = task.armed && deadlinePassed(now, task.deadline);
+      if (due) {
+        advance(task, now);
+      }
+      if (ready || due) {
+        task.run();
+      }
+    }
+
+    now = clock_.now();
+    uint32_t wait = FOREVER;
+    for (Task const &task : tasks_) {
+      if (task.ready.load(std::memory_order_relaxed)) return 0;
+      if (!task.armed) continue;
+      if (deadlinePassed(now, task.deadline)) return 0;
+      if (task.deadline - now < wait) {
+        wait = task.deadline - now;
+      }
+    }
+    return wait;
+  }
+
+  /**
+   * Run whatever is due, then sleep until the next deadline or notification.
+   */
+  void loop() { clock_.sleep(runDue()); }
+
+  Clock &clock() { return clock_; }
+
+ private:
+  struct Task {
+    Callback<void()> run;
+    uint32_t deadline = 0;
+    /**
+     * 0 for one-shot tasks.
+     */
+    uint32_t period = 0;
+    bool armed = false;
+    std::atomic<bool> ready{false};
+  };
+
+  static void advance(Task &task, uint32_t now) {
+    if (task.period == 0) {
+      task.armed = false;
+      return;
+    }
+    task.deadline += task.period;
+    // After falling behind by a whole period, skip the missed runs rather than
+    // catching up on them all at once.
+    if (!deadlinePassed(task.deadline, now)) {
+      task.deadline = now + task.period;
+    }
+  }
+
+  Task tasks_[Tasks];
+  Clock clock_;
+};
@@ -1,21 +1,19 @@
 #pragma once
 
 #include <Arduino.h>
+#include <driver/uart.h>
+
+#include <atomic>
+
+#include "homectl/Callback.h"
+#include "homectl/FrameCodec.h"
 
 /**
- * The sensor didn't respond within 1 second.
+ * The sensor didn't respond, even after retries.
  *
  * Retries probably won't help. Most likely the sensor isn't wired up correctly.
  */
 constexpr int STATUS_NO_RESPONSE = -2;
-/**
- * The data received from the sensor was of the correct length but was garbled.
- *
- * Retries are likely to help. If retries don't help, there is probably a lot of
- * interference on the RX wire to the sensor's TX, or the voltage is too low
- * (note that the sensor takes around 130mA while performing a measurement).
- */
-constexpr int STATUS_CHECKSUM_MISMATCH = -3;
 /**
  * The data received from the sensor was truncated.
  *
@@ -24,9 +22,81 @@ constexpr int STATUS_CHECKSUM_MISMATCH = -3;
  */
 constexpr int STATUS_INCOMPLETE = -4;
 
-int readResponse(Stream &io, byte *response, size_t recvSize, byte startByte);
+Print &operator<<(Print &out, FrameErrors const &errors);
+
+/**
+ * A Stream that knows when bytes have arrived, so that whoever parses its input
+ * only needs to run then, instead of polling available().
+ */
+class SerialPort : public Stream {
+ public:
+  /**
+   * Whether bytes arrived since the last call.
+   */
+  virtual bool takeRxEvent() = 0;
+
+  /**
+   * Called when bytes arrive, possibly on another task, so that whoever calls
+   * takeRxEvent() can sleep until then.
+   */
+  Callback<void()> received;
+};
+
+/**
+ * One of the ESP32's UARTs, driven by the ESP-IDF UART driver instead of
+ * HardwareSerial. Its RX interrupt moves incoming bytes into a ring buffer and
+ * posts an event to a queue once the line goes quiet, i.e. after each frame
+ * from a sensor. A small task per port waits on that queue and calls
+ * received().
+ */
+class UartPort : public SerialPort {
+ public:
+  /**
+   * The driver's ring buffer must be larger than the hardware FIFO. That is
+   * four PMS5003T frames, or 28 MH-Z19B responses.
+   */
+  static constexpr int RX_BUFFER_SIZE = 2 * UART_FIFO_LEN;
+  static constexpr int EVENT_QUEUE_SIZE = 8;
+
+  explicit UartPort(uart_port_t port) : port_(port) {}
+  /**
+   * Stop the task and the driver, which would otherwise go on using this port
+   * after it is gone.
+   */
+  ~UartPort();
+
+  /**
+   * Install the driver, at 8N1 on the given pins, and start the task that
+   * waits for its events.
+   */
+  void begin(unsigned long baud, int rxPin, int txPin);
+
+  bool takeRxEvent() override;
+  /**
+   * Number of times the RX buffer overflowed because its contents weren't read
+   * quickly enough. The parsers resync on the next frame after this happens.
+   */
+  uint32_t overflows() const {
+    return overflows_.load(std::memory_order_relaxed);
+  }
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  void flush() override;
+  size_t write(uint8_t b) override;
+  size_t write(uint8_t const *buffer, size_t size) override;
+
+ private:
+  static void waitForEvents(void *self);
 
-template <int N>
-static int readResponse(Stream &io, byte (&response)[N], byte startByte) {
-  return readResponse(io, response, N, startByte);
-}
+  uart_port_t port_;
+  QueueHandle_t events_ = nullptr;
+  TaskHandle_t task_ = nullptr;
+  std::atomic<bool> rxEvent_{false};
+  std::atomic<uint32_t> overflows_{0};
+  /**
+   * The byte returned by peek(), or -1.
+   */
+  int peeked_ = -1;
+};
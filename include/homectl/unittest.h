@@ -23,6 +23,14 @@ class UnitTest {
 
  public:
   static void run();
+
+  /**
+   * Number of heap allocations (malloc, calloc, realloc) made so far by any
+   * task. Only counted in the test environment, which defines
+   * COUNT_ALLOCATIONS and links with -Wl,--wrap for each of these functions;
+   * elsewhere this stays 0.
+   */
+  static uint32_t allocations();
 };
 
 #ifdef UNIT_TEST
@@ -64,9 +72,19 @@ void testFail(Args const &... args) {
   Serial.println();
 }
 
+/**
+ * Print additional information about a test run, e.g. benchmark results.
+ */
+template <typename... Args>
+void testInfo(Args const &... args) {
+  Serial.print("INFO:");
+  testPrint(Serial, args...);
+  Serial.println();
+}
+
 #define EXPECT_EQ(A, B)       \
   do {                        \
-    if (A != B) {             \
+    if ((A) != (B)) {         \
       testFail(A, " != ", B); \
       ctx.pass = false;       \
     }                         \
@@ -1,3 +1,3 @@
-pio.exe test --without-testing
+pio.exe test -e test --without-testing
 sleep 1
-pio.exe test --without-building --without-uploading
+pio.exe test -e test --without-building --without-uploading
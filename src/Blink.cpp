@@ -2,6 +2,8 @@
 
 #include <analogWrite.h>
 
+static_assert(255 % Blink::STEP == 0, "Blink would never reach 0 or 255");
+
 Blink::Blink(uint8_t pin) : pin_(pin) {
   // initialize the digital pin as an output.
   pinMode(pin_, OUTPUT);
@@ -21,9 +23,9 @@ void Blink::loop() {
 
   value_ += increment_;
   if (value_ == 255) {
-    increment_ = -1;
+    increment_ = -STEP;
   }
   if (value_ == 0) {
-    increment_ = 1;
+    increment_ = STEP;
   }
 }
@@ -2,6 +2,8 @@
 
 #include "homectl/Logger.h"
 
+LOG_MODULE(HOMECTL);
+
 PushButton::PushButton(uint8_t pin)
     : pin_(pin), switched_(true), prevState_(HIGH) {
   // initialize the pushbutton pin as an input:
@@ -1,163 +1,180 @@
 #include "homectl/CO2.h"
 
+#include "homectl/CO2Calibration.h"
 #include "homectl/Logger.h"
 #include "homectl/Matrix.h"
+#include "homectl/RobustFit.h"
+#include "homectl/Scheduler.h"
 #include "homectl/UART.h"
 
+LOG_MODULE(CO2);
+
 // The sensor delivers temperature readings in Celcius, but they are offset by
 // some amount. We subtract this amount when displaying the actual temperature.
 constexpr byte TEMPERATURE_OFFSET = 49;
 
-// Calibration values {Temp (Sensor), CO2 (Sensor), CO2 (Temtop)}:
-constexpr LinearFunction<2> correction{{
-    // Probably stable (measured after leaving the room with a closed
-    // door and windows).
-    {15, 481, 546},
-
-    {16, 441, 464},
-    {16, 491, 568},
-
-    {17, 468, 533},
-    {17, 535, 635},
-    {17, 544, 698},
-
-    {18, 416, 399},
-    {18, 749, 1099},
-    {18, 773, 1133},
-    {18, 814, 1200},
-
-    {20, 539, 699},
-    {20, 577, 776},
-
-    {21, 560, 739},
-
-    // Might not be stable (measured while in the room, door/windows
-    // closed).
-    {13, 540, 571},
+// At 9600 baud, a whole response takes 10ms to transfer.
+constexpr unsigned long FRAME_TIMEOUT_MS = 100;
 
-    {14, 580, 676},
+// Each recalibration weighs all earlier samples down by this factor, so they
+// are forgotten over about a hundred recalibrations.
+constexpr float RECALIBRATION_FORGETTING = 0.99f;
 
-    {15, 482, 413},
-    {15, 571, 561},
-    {15, 582, 663},
-    {15, 621, 726},
-    {15, 631, 704},
-    {15, 686, 859},
-    {15, 704, 891},
-
-    {16, 621, 752},
-    {16, 600, 670},
-    {16, 631, 696},
-    {16, 644, 751},
-    {16, 723, 933},
-
-    {17, 609, 755},
-    {17, 618, 767},
-    {17, 637, 834},
-    {17, 642, 838},
-    {17, 734, 1009},
-
-    {18, 565, 681},
-
-    {19, 554, 736},
-
-    {20, 552, 725},
-}};
+// Fitted at compile time, evaluated in float, since the ESP32 FPU doesn't do
+// double. A few of the calibration rows were taken before the sensor settled;
+// the Huber fit keeps those from pulling the correction off.
+constexpr CO2::Calibration initialCorrection{
+    robustFit<LinearFunction<2>>(co2Calibration, ROBUST_HUBER),
+    RECALIBRATION_FORGETTING};
 
 // Check that we didn't accidentally put more data in here than strictly
 // necessary for runtime computation.
-static_assert(sizeof correction == sizeof(double) * 3,
-              "extra data unaccounted for in LinearFunction");
+static_assert(sizeof(CO2::Calibration::State) == sizeof(float) * 12,
+              "extra data unaccounted for in calibration state");
 
-CO2::CO2(HardwareSerial &io) : input_(io) { io.begin(9600); }
+CO2::CO2(Stream &io) : input_(io), correction_(initialCorrection) {}
 
-static constexpr byte getCheckSum(byte const (&packet)[9]) {
-  byte checksum = 0;
-  for (byte i = 1; i < 8; i++) {
-    checksum += packet[i];
+void CO2::recalibrate(int ppmReference) {
+  if (lastPpmRaw_ < 0) {
+    LOG_AT(WARNING, F("no reading to recalibrate against"));
+    return;
   }
-  checksum = 0xff - checksum;
-  checksum += 1;
-  return checksum;
+  correction_.update(
+      {lastTemperature_, float(lastPpmRaw_), float(ppmReference)});
+  LOG(F("recalibrated: "), correction_.function());
 }
 
-static_assert(getCheckSum({0, 1, 2, 3, 4, 5, 6, 7, 8}) == 0xE4,
-              "getCheckSum is implemented wrong");
-
-static void sendCommand(Stream &io, byte (&cmd)[9]) {
-  LOG(F("  >>"), Bytes(cmd));
-  cmd[8] = getCheckSum(cmd);
-  io.write(cmd, 9);
+void CO2::setCalibration(Calibration::State const &state) {
+  correction_ = Calibration(state, RECALIBRATION_FORGETTING);
 }
 
-void CO2::setABC(bool enabled) const {
+using Codec = FrameCodec<MHZ19BFraming>;
+
+bool CO2::setABC(bool enabled) {
   byte cmd[9] = {0xFF, 0x01, 0x79, byte(enabled * 0xA0), 0x00, 0x00,
                  0x00, 0x00, 0x00};
-  sendCommand(input_, cmd);
+  return submit(cmd);
 }
 
-void CO2::calibrateZeroPoint() const {
+bool CO2::calibrateZeroPoint() {
   byte cmd[9] = {0xFF, 0x01, 0x87, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-  sendCommand(input_, cmd);
+  return submit(cmd);
 }
 
-void CO2::calibrateSpanPoint(uint16_t ppm) const {
+bool CO2::calibrateSpanPoint(uint16_t ppm) {
   byte cmd[9] = {0xFF, 0x01, 0x88, 0x00, byte(ppm / 256), byte(ppm % 256),
                  0x00, 0x00, 0x00};
-  sendCommand(input_, cmd);
+  return submit(cmd);
 }
 
-void CO2::requestReading() {
+bool CO2::requestReading() {
   byte cmd[9] = {0xFF, 0x01, 0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x79};
-  sendCommand(input_, cmd);
+  return submit(cmd);
 }
 
-void CO2::handleReading(byte (&response)[9]) const {
-  LOG(F("applying linear correction: "), correction);
-  int const ppm_raw = 256 * (int)response[2] + response[3];
-  int const temperature = response[4] - TEMPERATURE_OFFSET;
-  int const ppm_corrected = correction(temperature, ppm_raw);
-  int const unknown = 256 * (int)response[6] + response[7];
+bool CO2::submit(byte (&frame)[9]) {
+  Codec::encode(frame);
+  auto const same = [&frame](Command const &command) {
+    return memcmp(command.frame, frame, sizeof frame) == 0;
+  };
+  for (int i = 0; i < inFlightSize_; ++i) {
+    if (same(inFlight_[i])) return true;
+  }
+  for (Command const &command : queued_) {
+    if (same(command)) return true;
+  }
 
-  byte const status = response[5];
+  Command command{};
+  memcpy(command.frame, frame, sizeof frame);
+  if (!queued_.push(std::move(command))) {
+    LOGF_AT(WARNING, F("command queue full, dropped command %02X"), frame[2]);
+    return false;
+  }
+  sendQueued(millis());
+  return true;
+}
 
-  // Is always 0 for version 19b.
-  if (status != 0) {
-    LOGF(F("status not OK: %02X"), status);
+int CO2::findInFlight(byte command) const {
+  for (int i = 0; i < inFlightSize_; ++i) {
+    if (inFlight_[i].command() == command) return i;
   }
+  return -1;
+}
 
-  input_.flush();
+void CO2::sendQueued(unsigned long now) {
+  // Responses are matched by command byte, so only one command per command
+  // byte can be in flight.
+  while (!queued_.empty() && inFlightSize_ < MAX_IN_FLIGHT &&
+         findInFlight(queued_.front().command()) < 0) {
+    Command &command = inFlight_[inFlightSize_++];
+    command = queued_.front();
+    queued_.pop();
+    transmit(command, now);
+  }
+}
 
-  return newReading(Reading{ppm_raw, ppm_corrected, temperature, unknown});
+void CO2::transmit(Command &command, unsigned long now) {
+  LOG_AT(DEBUG, F("  >>"), Bytes(command.frame));
+  input_.write(command.frame, sizeof command.frame);
+  command.deadline = now + (COMMAND_TIMEOUT_MS << command.attempts);
+  ++command.attempts;
 }
 
-void CO2::loop() {
-  if (input_.available() == 0) return;
+void CO2::complete(int inFlight, CommandOutcome outcome) {
+  CommandResult const result{inFlight_[inFlight].command(), outcome,
+                             inFlight_[inFlight].attempts};
+  inFlight_[inFlight] = inFlight_[--inFlightSize_];
+  if (!commandDone.post(result)) {
+    LOG_AT(WARNING, F("dropped CO2 command result; "), commandDone.dropped(),
+           F(" so far"));
+  }
+}
 
-  byte response[9];
+void CO2::handleReading(byte const *response) {
+  LOG_AT(DEBUG, F("applying linear correction: "), correction_.function());
+  int const ppm_raw = readBigEndian<uint16_t>(response + MHZ19BFraming::PPM);
+  int const temperature =
+      response[MHZ19BFraming::TEMPERATURE] - TEMPERATURE_OFFSET;
+  float const correctionTemperature =
+      isnan(temperature_) ? temperature : temperature_;
+  int const ppm_corrected = correction_(correctionTemperature, ppm_raw);
+  int const unknown =
+      readBigEndian<uint16_t>(response + MHZ19BFraming::UNKNOWN);
 
-  int const ret = readResponse(input_, response, 0xFF);
-  if (ret != 0) {
-    LOG(F("error reading response: "), ret);
-    return;
+  byte const status = response[MHZ19BFraming::STATUS];
+
+  // Is always 0 for version 19b.
+  if (status != 0) {
+    LOGF_AT(WARNING, F("status not OK: %02X"), status);
   }
 
-  byte const check = getCheckSum(response);
-  if (response[8] != check) {
-    LOG(F("checksum failed"));
-    LOGF(F("received: %02X"), response[8]);
-    LOGF(F("should be: %02X"), check);
-    input_.flush();
-    // STATUS_CHECKSUM_MISMATCH
-    return;
+  lastTemperature_ = correctionTemperature;
+  lastPpmRaw_ = ppm_raw;
+  if (!newReading.post(
+          Reading{ppm_raw, ppm_corrected, temperature, unknown})) {
+    LOG_AT(WARNING, F("dropped CO2 reading; "), newReading.dropped(),
+           F(" so far"));
+  }
+}
+
+void CO2::handleFrame(byte const *frame) {
+  LOG_AT(DEBUG, F("  <<"), Bytes(frame, MHZ19BFraming::MAX_LEN));
+
+  byte const command = frame[MHZ19BFraming::COMMAND];
+  int const inFlight = findInFlight(command);
+  if (inFlight >= 0) {
+    complete(inFlight, COMMAND_ACKED);
+  } else {
+    LOGF_AT(WARNING, F("unsolicited response to command %02X"), command);
   }
 
-  switch (response[1]) {
+  switch (command) {
     case 0x79:
       // setABC
       break;
     case 0x86:
-      return handleReading(response);
+      handleReading(frame);
+      break;
     case 0x87:
       // calibrateZeroPoint
       break;
@@ -165,9 +182,56 @@ void CO2::loop() {
       // calibrateSpanPoint
       break;
     default:
-      LOGF(F("got response to unknown command: %02X"), response[1]);
+      LOGF_AT(WARNING, F("got response to unknown command: %02X"), command);
       break;
   }
+
+  // A command with the same command byte may have been waiting for this one.
+  sendQueued(millis());
+}
+
+void CO2::receive() {
+  unsigned long const now = millis();
+  uint32_t const errors = parser_.errors().total();
+
+  // Take whatever has arrived, without waiting for more.
+  while (input_.available() > 0) {
+    if (parser_.size() == 0) {
+      frameDeadline_ = now + FRAME_TIMEOUT_MS;
+    }
+    parser_.push(input_.read(),
+                 [this](byte const *frame, int) { handleFrame(frame); });
+  }
+
+  if (parser_.errors().total() != errors) {
+    LOG_AT(WARNING, F("garbled MH-Z19B output; so far "), parser_.errors());
+  }
+}
+
+void CO2::loop() {
+  unsigned long const now = millis();
+
+  if (parser_.size() != 0 && deadlinePassed(now, frameDeadline_)) {
+    LOG_AT(WARNING, F("error reading response: "), STATUS_INCOMPLETE,
+           F(" after "), parser_.size(), F(" bytes"));
+    parser_.clear();
+  }
+
+  for (int i = 0; i < inFlightSize_;) {
+    Command &command = inFlight_[i];
+    if (!deadlinePassed(now, command.deadline)) {
+      ++i;
+    } else if (command.attempts < MAX_ATTEMPTS) {
+      LOGF_AT(WARNING, F("no response to command %02X, retrying"),
+              command.command());
+      transmit(command, now);
+      ++i;
+    } else {
+      LOG_AT(WARNING, F("error reading response: "), STATUS_NO_RESPONSE);
+      complete(i, COMMAND_TIMED_OUT);
+    }
+  }
+  sendQueued(now);
 }
 
 Print &operator<<(Print &out, CO2::Reading const &reading) {
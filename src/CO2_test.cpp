@@ -0,0 +1,197 @@
+#include "homectl/CO2.h"
+
+#include "homectl/FakeSerialPort.h"
+#include "homectl/unittest.h"
+
+class CO2Listener {
+ public:
+  int readings = 0;
+  CO2::Reading last{};
+  int results = 0;
+  CO2::CommandResult done[4];
+
+  void handle(CO2::Reading const &reading) {
+    ++readings;
+    last = reading;
+  }
+
+  void commandDone(CO2::CommandResult const &result) {
+    if (results < 4) {
+      done[results] = result;
+    }
+    ++results;
+  }
+};
+
+/**
+ * Response to requestReading() with the given raw values.
+ */
+static void makeReading(byte (&frame)[9], int ppm, byte temperature) {
+  byte const data[9] = {0xFF, 0x86, byte(ppm / 256), byte(ppm % 256),
+                        temperature, 0, 0, 0, 0};
+  memcpy(frame, data, sizeof frame);
+  FrameCodec<MHZ19BFraming>::encode(frame);
+}
+
+/**
+ * Acknowledgement of the given command.
+ */
+static void makeAck(byte (&frame)[9], byte command) {
+  byte const data[9] = {0xFF, command, 1, 0, 0, 0, 0, 0, 0};
+  memcpy(frame, data, sizeof frame);
+  FrameCodec<MHZ19BFraming>::encode(frame);
+}
+
+// Runs the same path as Homectl::State::pollSensors().
+static void pump(FakeSerialPort<> &port, CO2 &co2) {
+  if (port.takeRxEvent()) {
+    co2.receive();
+  }
+  co2.loop();
+  co2.newReading.dispatch();
+  co2.commandDone.dispatch();
+}
+
+TEST(CO2, ReceivesInPieces) {
+  FakeSerialPort<> port;
+  CO2Listener listener;
+  CO2 co2{co2.newReading.listen<CO2Listener, &CO2Listener::handle>(listener),
+          port};
+
+  co2.requestReading();
+  EXPECT_EQ(port.written, 9);
+
+  byte frame[9];
+  makeReading(frame, 800, 49 + 22);
+  port.feed(frame, 4);
+  pump(port, co2);
+  EXPECT_EQ(listener.readings, 0);
+  port.feed(frame + 4, 5);
+  pump(port, co2);
+  EXPECT_EQ(listener.readings, 1);
+  EXPECT_EQ(listener.last.ppm_raw, 800);
+  EXPECT_EQ(listener.last.temperature, 22);
+
+  // Nothing arrived, so nothing to parse.
+  EXPECT_EQ(port.takeRxEvent(), false);
+}
+
+TEST(CO2, ResyncsAfterGarbage) {
+  FakeSerialPort<> port;
+  CO2Listener listener;
+  CO2 co2{co2.newReading.listen<CO2Listener, &CO2Listener::handle>(listener),
+          port};
+
+  byte frame[9];
+  makeReading(frame, 1200, 49 + 20);
+  byte corrupt[9];
+  memcpy(corrupt, frame, sizeof corrupt);
+  corrupt[3] ^= 0x10;
+
+  byte const garbage[] = {0x12, 0x34};
+  port.feed(garbage);
+  port.feed(corrupt);
+  port.feed(frame);
+  pump(port, co2);
+  EXPECT_EQ(listener.readings, 1);
+  EXPECT_EQ(listener.last.ppm_raw, 1200);
+}
+
+TEST(CO2, PipelinesCommands) {
+  FakeSerialPort<> port;
+  CO2Listener listener;
+  CO2 co2{co2.newReading.listen<CO2Listener, &CO2Listener::handle>(listener),
+          co2.commandDone.listen<CO2Listener, &CO2Listener::commandDone>(
+              listener),
+          port};
+
+  // All three have different command bytes, so are sent right away. Asking
+  // for a reading again while one is in flight does nothing.
+  EXPECT_EQ(co2.calibrateZeroPoint(), true);
+  EXPECT_EQ(co2.calibrateSpanPoint(2000), true);
+  EXPECT_EQ(co2.requestReading(), true);
+  EXPECT_EQ(co2.requestReading(), true);
+  EXPECT_EQ(port.written, 27);
+
+  // Responses can come in any order.
+  byte frame[9];
+  makeAck(frame, 0x88);
+  port.feed(frame);
+  makeReading(frame, 600, 49 + 21);
+  port.feed(frame);
+  makeAck(frame, 0x87);
+  port.feed(frame);
+  pump(port, co2);
+
+  EXPECT_EQ(listener.results, 3);
+  EXPECT_EQ(listener.done[0].command, 0x88);
+  EXPECT_EQ(listener.done[1].command, 0x86);
+  EXPECT_EQ(listener.done[2].command, 0x87);
+  EXPECT_EQ(listener.done[1].outcome, CO2::COMMAND_ACKED);
+  EXPECT_EQ(listener.done[1].attempts, 1);
+  EXPECT_EQ(listener.readings, 1);
+  EXPECT_EQ(listener.last.ppm_raw, 600);
+}
+
+TEST(CO2, RetriesCommands) {
+  FakeSerialPort<> port;
+  CO2Listener listener;
+  CO2 co2{co2.newReading.listen<CO2Listener, &CO2Listener::handle>(listener),
+          co2.commandDone.listen<CO2Listener, &CO2Listener::commandDone>(
+              listener),
+          port};
+
+  co2.requestReading();
+  delay(CO2::COMMAND_TIMEOUT_MS + 10);
+  pump(port, co2);
+  EXPECT_EQ(port.written, 18);
+  EXPECT_EQ(listener.results, 0);
+
+  // Answer the second attempt.
+  byte frame[9];
+  makeReading(frame, 700, 49 + 21);
+  port.feed(frame);
+  pump(port, co2);
+  EXPECT_EQ(listener.results, 1);
+  EXPECT_EQ(listener.done[0].outcome, CO2::COMMAND_ACKED);
+  EXPECT_EQ(listener.done[0].attempts, 2);
+  EXPECT_EQ(listener.readings, 1);
+}
+
+TEST(CO2, TimesOutCommands) {
+  FakeSerialPort<> port;
+  CO2Listener listener;
+  CO2 co2{co2.newReading.listen<CO2Listener, &CO2Listener::handle>(listener),
+          co2.commandDone.listen<CO2Listener, &CO2Listener::commandDone>(
+              listener),
+          port};
+
+  co2.requestReading();
+  EXPECT_EQ(port.written, 9);
+
+  // Each attempt gets twice as long as the one before.
+  unsigned long timeout = CO2::COMMAND_TIMEOUT_MS;
+  for (int attempt = 1; attempt < CO2::MAX_ATTEMPTS; ++attempt) {
+    delay(timeout - 10);
+    pump(port, co2);
+    EXPECT_EQ(port.written, 9 * attempt);
+    delay(20);
+    pump(port, co2);
+    EXPECT_EQ(port.written, 9 * (attempt + 1));
+    timeout *= 2;
+  }
+  EXPECT_EQ(listener.results, 0);
+
+  // No more attempts after the last one runs out.
+  delay(timeout - 10);
+  pump(port, co2);
+  EXPECT_EQ(listener.results, 0);
+  delay(20);
+  pump(port, co2);
+  EXPECT_EQ(port.written, 9 * CO2::MAX_ATTEMPTS);
+  EXPECT_EQ(listener.results, 1);
+  EXPECT_EQ(listener.done[0].command, 0x86);
+  EXPECT_EQ(listener.done[0].outcome, CO2::COMMAND_TIMED_OUT);
+  EXPECT_EQ(listener.done[0].attempts, 3);
+  EXPECT_EQ(listener.readings, 0);
+}
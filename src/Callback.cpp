@@ -1 +1,10 @@
 #include "homectl/Callback.h"
+
+#include "homectl/Logger.h"
+
+LOG_MODULE(HOMECTL);
+
+void logSignalFull(int capacity) {
+  LOG_AT(ERROR, F("Signal already has "), capacity,
+         F(" listeners; ignoring another one"));
+}
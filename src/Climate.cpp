@@ -0,0 +1,102 @@
+#include "homectl/Climate.h"
+
+#include <math.h>
+
+// How fast the estimates drift by themselves, in variance per second: the room
+// temperature drifts by about 0.1C per minute, the humidity by 0.25% per
+// minute, and sensor offsets hardly change at all.
+static constexpr Climate::Filter::Vector DRIFT_PER_SECOND = {
+    {1.7e-4f, 1e-3f, 1e-8f, 1e-8f, 1e-8f}};
+
+// Until the first readings come in, we know nothing about the room, and sensor
+// offsets are probably less than 10 degrees or percent.
+static constexpr Climate::Filter::Vector INITIAL_VARIANCE = {
+    {1e4f, 1e4f, 100, 100, 100}};
+
+/**
+ * Variance of the measurement noise of each sensor, indexed by Climate::Sensor.
+ */
+struct NoiseModel {
+  float temperature;
+  float humidity;
+};
+
+static constexpr NoiseModel NOISE[] = {
+    // DHT22: 0.1 resolution, with some jitter on the humidity.
+    {0.01f, 0.25f},
+    // MH-Z19B: whole degrees, so at least 1/12 rounding noise. No humidity.
+    {0.15f, 0},
+    // PMS5003T: 0.1 resolution, like the DHT22.
+    {0.01f, 0.25f},
+};
+
+// Readings further than this many standard deviations from the estimate are
+// glitches.
+static constexpr float GATE = 5;
+
+// An estimate with a larger variance than this (2 degrees or percent standard
+// deviation) is not worth reporting.
+static constexpr float MAX_VARIANCE = 4;
+
+Climate::Climate() : filter_{{}, INITIAL_VARIANCE} {}
+
+Climate::Filter::Vector Climate::temperatureRow(Sensor sensor) {
+  switch (sensor) {
+    case SENSOR_DHT22:
+      return {{1, 0, 0, 0, 0}};
+    case SENSOR_MHZ19B:
+      return {{1, 0, 1, 0, 0}};
+    case SENSOR_PMS5003T:
+      return {{1, 0, 0, 1, 0}};
+  }
+  return {};
+}
+
+Climate::Filter::Vector Climate::humidityRow(Sensor sensor) {
+  switch (sensor) {
+    case SENSOR_DHT22:
+      return {{0, 1, 0, 0, 0}};
+    case SENSOR_MHZ19B:
+      return {};
+    case SENSOR_PMS5003T:
+      return {{0, 1, 0, 0, 1}};
+  }
+  return {};
+}
+
+void Climate::add(Sensor sensor, unsigned long now, float temperature,
+                  float humidity) {
+  filter_.predict(DRIFT_PER_SECOND, (now - lastUpdate_) / 1000.f);
+  lastUpdate_ = now;
+
+  if (!isnan(temperature)) {
+    filter_.update(temperatureRow(sensor), temperature,
+                   NOISE[sensor].temperature, GATE);
+  }
+  if (!isnan(humidity) && NOISE[sensor].humidity != 0) {
+    filter_.update(humidityRow(sensor), humidity, NOISE[sensor].humidity,
+                   GATE);
+  }
+}
+
+float Climate::estimate(Filter::Vector const &h) const {
+  float value = 0;
+  float variance = 0;
+  for (int i = 0; i < STATES; ++i) {
+    value += h[i] * filter_[i];
+    for (int j = 0; j < STATES; ++j) {
+      variance += h[i] * filter_.state().P[i][j] * h[j];
+    }
+  }
+  return variance <= MAX_VARIANCE ? value : NAN;
+}
+
+float Climate::temperature() const {
+  return estimate(temperatureRow(SENSOR_DHT22));
+}
+
+float Climate::humidity() const { return estimate(humidityRow(SENSOR_DHT22)); }
+
+float Climate::temperature(Sensor sensor) const {
+  return estimate(temperatureRow(sensor));
+}
@@ -0,0 +1,152 @@
+#include "homectl/Climate.h"
+
+#include <math.h>
+
+#include "homectl/unittest.h"
+
+/**
+ * Deterministic, roughly normally distributed noise, so that the recorded
+ * sequences are the same on every run.
+ */
+class Noise {
+  uint32_t state_ = 12345;
+
+  float uniform() {
+    state_ = state_ * 1664525 + 1013904223;
+    return float(state_ >> 8) / (1 << 24) - 0.5f;
+  }
+
+ public:
+  float operator()(float stddev) {
+    // The sum of 12 uniforms has variance 1.
+    float sum = 0;
+    for (int i = 0; i < 12; ++i) {
+      sum += uniform();
+    }
+    return sum * stddev;
+  }
+};
+
+static float roundTo(float x, float step) { return roundf(x / step) * step; }
+
+/**
+ * Half an hour of simulated readings every 6 seconds from a room heating up
+ * and getting more humid, with offsets and resolutions like the real sensors'.
+ */
+struct Recording {
+  static constexpr int STEPS = 300;
+  static constexpr unsigned long STEP_MS = 6000;
+  static constexpr float MHZ19B_OFFSET = 3.2f;
+  static constexpr float PMS5003T_OFFSET = 1.5f;
+  static constexpr float PMS5003T_HUMIDITY_OFFSET = -4;
+
+  float temperature[STEPS];
+  float humidity[STEPS];
+  float dht22Temperature[STEPS];
+  float dht22Humidity[STEPS];
+  float mhz19bTemperature[STEPS];
+  float pms5003tTemperature[STEPS];
+  float pms5003tHumidity[STEPS];
+
+  Recording() {
+    Noise noise;
+    for (int i = 0; i < STEPS; ++i) {
+      float const t = i * STEP_MS / 1000.f;
+      temperature[i] = 21 + 1.5f * (1 - expf(-t / 600));
+      humidity[i] = 45 + 5 * t / 1800;
+      dht22Temperature[i] = roundTo(temperature[i] + noise(0.1f), 0.1f);
+      dht22Humidity[i] = roundTo(humidity[i] + noise(0.5f), 0.1f);
+      mhz19bTemperature[i] =
+          roundf(temperature[i] + MHZ19B_OFFSET + noise(0.2f));
+      pms5003tTemperature[i] =
+          roundTo(temperature[i] + PMS5003T_OFFSET + noise(0.1f), 0.1f);
+      pms5003tHumidity[i] = roundTo(
+          humidity[i] + PMS5003T_HUMIDITY_OFFSET + noise(0.5f), 0.1f);
+    }
+    // The DHT22 occasionally fails to read, and occasionally glitches.
+    dht22Temperature[100] = NAN;
+    dht22Humidity[100] = NAN;
+    dht22Temperature[200] = 85;
+  }
+};
+
+static float rms(float sum, int n) { return sqrtf(sum / n); }
+
+TEST(Climate, NoEstimateWithoutReadings) {
+  Climate climate;
+  EXPECT_EQ(isnan(climate.temperature()), true);
+  EXPECT_EQ(isnan(climate.humidity()), true);
+
+  climate.add(Climate::SENSOR_DHT22, 0, 21, 45);
+  EXPECT_EQ(fabsf(climate.temperature() - 21) < 0.1f, true);
+  EXPECT_EQ(fabsf(climate.humidity() - 45) < 0.1f, true);
+  // The CO2 sensor's offset is still unknown.
+  EXPECT_EQ(isnan(climate.temperature(Climate::SENSOR_MHZ19B)), true);
+
+  climate.add(Climate::SENSOR_MHZ19B, 6000, 24, NAN);
+  EXPECT_EQ(fabsf(climate.temperature(Climate::SENSOR_MHZ19B) - 24) < 0.5f,
+            true);
+}
+
+TEST(Climate, FusesRecording) {
+  static Recording const rec;
+  static Climate climate;
+
+  // Compare only once the offsets have settled, after the first 5 minutes.
+  constexpr int SETTLE = 50;
+  float fusedError = 0;
+  float dhtError = 0;
+  float fusedHumidityError = 0;
+  float dhtHumidityError = 0;
+  float co2Error = 0;
+  float co2RawError = 0;
+  int n = 0;
+
+  unsigned long const start = micros();
+  for (int i = 0; i < Recording::STEPS; ++i) {
+    unsigned long const now = i * Recording::STEP_MS;
+    climate.add(Climate::SENSOR_DHT22, now, rec.dht22Temperature[i],
+                rec.dht22Humidity[i]);
+    climate.add(Climate::SENSOR_MHZ19B, now + 100, rec.mhz19bTemperature[i],
+                NAN);
+    climate.add(Climate::SENSOR_PMS5003T, now + 200,
+                rec.pms5003tTemperature[i], rec.pms5003tHumidity[i]);
+    if (i < SETTLE || isnan(rec.dht22Temperature[i]) ||
+        rec.dht22Temperature[i] > 50) {
+      continue;
+    }
+
+    float const t = rec.temperature[i];
+    float const h = rec.humidity[i];
+    fusedError += powf(climate.temperature() - t, 2);
+    dhtError += powf(rec.dht22Temperature[i] - t, 2);
+    fusedHumidityError += powf(climate.humidity() - h, 2);
+    dhtHumidityError += powf(rec.dht22Humidity[i] - h, 2);
+    float const co2 = t + Recording::MHZ19B_OFFSET;
+    co2Error += powf(climate.temperature(Climate::SENSOR_MHZ19B) - co2, 2);
+    co2RawError += powf(rec.mhz19bTemperature[i] - co2, 2);
+    ++n;
+  }
+  unsigned long const ns =
+      (micros() - start) * 1000 / (3 * Recording::STEPS);
+
+  EXPECT_EQ(rms(fusedError, n) < rms(dhtError, n), true);
+  EXPECT_EQ(rms(fusedHumidityError, n) < rms(dhtHumidityError, n), true);
+  EXPECT_EQ(rms(co2Error, n) < rms(co2RawError, n) / 2, true);
+  EXPECT_EQ(
+      fabsf(climate.filter()[Climate::MHZ19B_TEMPERATURE_OFFSET] -
+            Recording::MHZ19B_OFFSET) < 0.3f,
+      true);
+  EXPECT_EQ(
+      fabsf(climate.filter()[Climate::PMS5003T_HUMIDITY_OFFSET] -
+            Recording::PMS5003T_HUMIDITY_OFFSET) < 0.5f,
+      true);
+
+  testInfo("RMS temperature error: fused ", rms(fusedError, n), "C, DHT22 ",
+           rms(dhtError, n), "C");
+  testInfo("RMS humidity error: fused ", rms(fusedHumidityError, n),
+           "%, DHT22 ", rms(dhtHumidityError, n), '%');
+  testInfo("RMS MH-Z19B temperature error: fused ", rms(co2Error, n),
+           "C, raw ", rms(co2RawError, n), "C");
+  testInfo(ns, "ns per reading");
+}
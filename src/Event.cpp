@@ -0,0 +1 @@
+#include "homectl/Event.h"
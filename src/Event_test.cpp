@@ -0,0 +1,49 @@
+#include "homectl/Event.h"
+
+#include <thread>
+
+#include "homectl/unittest.h"
+
+TEST(Mailbox, DropsWhenFull) {
+  Mailbox<int, 2> mailbox;
+  EXPECT_EQ(mailbox.post(1), true);
+  EXPECT_EQ(mailbox.post(2), true);
+  EXPECT_EQ(mailbox.post(3), false);
+  EXPECT_EQ(mailbox.dropped(), 1);
+
+  int sum = 0;
+  EXPECT_EQ(mailbox.drain([&](int v) { sum = sum * 10 + v; }), 2);
+  EXPECT_EQ(sum, 12);
+  EXPECT_EQ(mailbox.drain([&](int v) { sum = 0; }), 0);
+}
+
+class ReadingListener {
+ public:
+  int readings = 0;
+  int last = 0;
+
+  void handle(int const &reading) {
+    ++readings;
+    last = reading;
+  }
+};
+
+TEST(EventChannel, DispatchOnConsumerTask) {
+  EventChannel<int, 4, 2> channel;
+  ReadingListener listener;
+  channel.listen<ReadingListener, &ReadingListener::handle>(listener).listen();
+
+  // Post from another task; listeners only run when we dispatch.
+  std::thread producer([&] {
+    for (int i = 1; i <= 3; ++i) {
+      channel.post(i);
+    }
+  });
+  producer.join();
+  EXPECT_EQ(listener.readings, 0);
+
+  EXPECT_EQ(channel.dispatch(), 3);
+  EXPECT_EQ(listener.readings, 3);
+  EXPECT_EQ(listener.last, 3);
+  EXPECT_EQ(channel.dropped(), 0);
+}
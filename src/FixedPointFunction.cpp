@@ -0,0 +1,36 @@
+#include "homectl/FixedPointFunction.h"
+
+#include "homectl/CO2Calibration.h"
+
+static constexpr LinearFunction<2> co2Fit{co2Calibration};
+static constexpr MatrixRow<2> co2Bounds{{50, 5000}};
+static constexpr FixedPointFunction<2> co2Fixed{co2Fit, co2Bounds};
+
+static constexpr bool testFixedPointWithinBound() {
+  double const bound = co2Fixed.errorBound(co2Bounds);
+  for (int temp = -50; temp <= 50; temp += 5) {
+    for (int ppm = 0; ppm <= 5000; ppm += 50) {
+      double const error = absolute(co2Fixed(temp, ppm) - co2Fit(temp, ppm));
+      if (error > bound) return false;
+    }
+  }
+  return true;
+}
+
+static_assert(co2Fixed.frac() == 16, "unexpected Q format");
+static_assert(co2Fixed.errorBound(co2Bounds) < 0.6,
+              "fixed point error should be within rounding of the result");
+static_assert(testFixedPointWithinBound(), "testFixedPointWithinBound failed");
+
+static constexpr bool testFixedPointRounding() {
+  // y = 0.25 - 1.5 x
+  constexpr LinearFunction<1> f{{
+      {0, 0.25},
+      {1, -1.25},
+  }};
+  constexpr FixedPointFunction<1> fixed{f, {{100}}};
+  return fixed(0) == 0 && fixed(1) == -1 && fixed(2) == -3 &&
+         fixed(-3) == 5 && fixed(100) == -150;
+}
+
+static_assert(testFixedPointRounding(), "testFixedPointRounding failed");
@@ -0,0 +1,85 @@
+#include "homectl/FrameCodec.h"
+
+#include "homectl/CO2.h"
+#include "homectl/PMS5003T.h"
+
+static constexpr bool testBigEndian() {
+  uint8_t data[3] = {0x12, 0x34, 0x56};
+  bool const read = readBigEndian<uint16_t>(data) == 0x1234 &&
+                    readBigEndian<uint32_t, 3>(data) == 0x123456;
+  writeBigEndian<uint16_t>(data + 1, 0xabcd);
+  return read && data[0] == 0x12 && data[1] == 0xab && data[2] == 0xcd;
+}
+
+static_assert(testBigEndian(), "testBigEndian failed");
+
+static constexpr bool testMHZ19BChecksum() {
+  uint8_t const frame[9] = {0, 1, 2, 3, 4, 5, 6, 7, 0xE4};
+  return MHZ19BFraming::checksum(frame, 9) == 0xE4 &&
+         FrameCodec<MHZ19BFraming>::verify(frame, 9);
+}
+
+static_assert(testMHZ19BChecksum(), "testMHZ19BChecksum failed");
+
+static constexpr bool testMHZ19BEncode() {
+  // The read command, whose checksum is documented in the data sheet.
+  uint8_t cmd[9] = {0, 0x01, 0x86, 0, 0, 0, 0, 0, 0};
+  FrameCodec<MHZ19BFraming>::encode(cmd);
+  return cmd[0] == 0xFF && cmd[8] == 0x79;
+}
+
+static_assert(testMHZ19BEncode(), "testMHZ19BEncode failed");
+
+static constexpr bool testPMS5003TEncode() {
+  // The sleep command, as documented in the data sheet.
+  uint8_t cmd[7] = {0, 0, 0xe4, 0x00, 0x00, 0, 0};
+  FrameCodec<PMS5003TFraming>::encode(cmd);
+  return cmd[0] == 0x42 && cmd[1] == 0x4d && cmd[5] == 0x01 &&
+         cmd[6] == 0x73;
+}
+
+static_assert(testPMS5003TEncode(), "testPMS5003TEncode failed");
+
+static constexpr bool testPMS5003TLength() {
+  uint8_t const measurement[] = {0x42, 0x4d, 0x00, 0x1c};
+  uint8_t const sleep[] = {0x42, 0x4d, 0x00, 0x04};
+  uint8_t const garbled[] = {0x42, 0x4d, 0x01, 0x1c};
+  return PMS5003TFraming::frameLength(measurement) == 32 &&
+         PMS5003TFraming::frameLength(sleep) == 8 &&
+         PMS5003TFraming::frameLength(garbled) == 0;
+}
+
+static_assert(testPMS5003TLength(), "testPMS5003TLength failed");
+
+/**
+ * The SDS011 particulate matter sensor, as an example of a protocol with a
+ * tail byte.
+ */
+struct SDS011Framing {
+  static constexpr uint32_t SYNC = 0xAAC0;
+  static constexpr int SYNC_LEN = 2;
+  static constexpr uint32_t TAIL = 0xAB;
+  static constexpr int TAIL_LEN = 1;
+  static constexpr int HEADER_LEN = 2;
+  static constexpr int MAX_LEN = 10;
+  static constexpr int CHECKSUM_LEN = 1;
+
+  static constexpr int frameLength(uint8_t const *header) { return MAX_LEN; }
+  static constexpr uint8_t checksum(uint8_t const *frame, int len) {
+    return uint8_t(byteSum(frame, 2, 8));
+  }
+};
+
+static constexpr bool testSDS011() {
+  uint8_t const frame[] = {0xAA, 0xC0, 0xD4, 0x04, 0x3A,
+                           0x0A, 0xA1, 0x60, 0x1D, 0xAB};
+  uint8_t badTail[10] = {};
+  for (int i = 0; i < 10; ++i) {
+    badTail[i] = frame[i];
+  }
+  badTail[9] = 0xAC;
+  return FrameCodec<SDS011Framing>::verify(frame, 10) &&
+         !FrameCodec<SDS011Framing>::verify(badTail, 10);
+}
+
+static_assert(testSDS011(), "testSDS011 failed");
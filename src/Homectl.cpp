@@ -1,5 +1,7 @@
 #include "homectl/Homectl.h"
 
+LOG_MODULE(HOMECTL);
+
 /**
  * Number of seconds to wait between logging sensor measurements. This is
  * currently 6, because the MH-Z19B doesn't do more than one measurement per
@@ -7,13 +9,20 @@
  */
 constexpr int secsPerLog = 6;
 
+// How often to poll what can't wake up the main loop by itself. The sensor
+// drivers only need this for their timeouts, since bytes from the sensors wake
+// up the loop right away.
+constexpr unsigned long BUTTON_POLL_MS = 20;
+constexpr unsigned long USB_ECHO_POLL_MS = 50;
+constexpr unsigned long SENSOR_POLL_MS = 100;
+
 static void pad(Print &out, size_t sz) {
   while (sz < Homectl::LCD_COLS) sz += out.print(' ');
 }
 
 void Homectl::State::showPMSReading(PMS5003T::Reading const &reading) {
-  // We got a reading, so put the sensor back to sleep.
-  pms5003t.sleep(true);
+  addClimateReading(Climate::SENSOR_PMS5003T, int16_t(reading.temp) / 10.f,
+                    int16_t(reading.hum) / 10.f);
 
   lcd.setCursor(0, 3);
   pad(lcd, reading.printTo(lcd));
@@ -21,53 +30,94 @@ void Homectl::State::showPMSReading(PMS5003T::Reading const &reading) {
 
 void Homectl::State::showCO2Reading(CO2::Reading const &reading) {
   LOG(reading);
+  addClimateReading(Climate::SENSOR_MHZ19B, reading.temperature, NAN);
   lcd.setCursor(0, 0);
   pad(lcd, reading.printTo(lcd));
 }
 
-void Homectl::handleLoopTimer() {
-  unsigned long const currTime = millis();
-
-  if (currTime - state.lastTime >= secsPerLog * 1000) {
-    LOG(state.iterations / secsPerLog, F(" iterations per second ("),
-        secsPerLog / double(state.iterations) * 1e6, 0, F("μs per iteration)"));
-    state.lastTime = currTime / 1000 * 1000;
-    state.iterations = 0;
-
-    state.co2.requestReading();
+void Homectl::State::handleCO2Command(CO2::CommandResult const &result) {
+  // Show right away that the reading we asked for isn't coming.
+  if (result.command == 0x86 && result.outcome == CO2::COMMAND_TIMED_OUT) {
+    lcd.setCursor(0, 0);
+    pad(lcd, lcd.print(F("CO2: no response")));
+  }
+}
 
-    float temperature = state.dht.readTemperature(false);
-    state.lcd.setCursor(0, 1);
-    pad(state.lcd, state.lcd.printf("Temp: %.2fC", temperature));
+void Homectl::State::addClimateReading(Climate::Sensor sensor,
+                                       float temperature, float humidity) {
+  climate.add(sensor, millis(), temperature, humidity);
+  // Takes effect from the next CO2 reading on.
+  co2.setTemperature(climate.temperature(Climate::SENSOR_MHZ19B));
+}
 
-    float humidity = state.dht.readHumidity();
-    state.lcd.setCursor(0, 2);
-    pad(state.lcd, state.lcd.printf("Hum: %.2f%%", humidity));
+void Homectl::State::pollSensors() {
+  // Only parse sensor output when the UARTs have received some.
+  if (pms5003tPort.takeRxEvent()) {
+    pms5003t.receive();
   }
+  pms5003t.loop();
+  if (co2Port.takeRxEvent()) {
+    co2.receive();
+  }
+  co2.loop();
 
-  ++state.iterations;
+  // Handle new readings only after parsing, so that slow listeners (like the
+  // LCD) don't hold up reading from the sensors.
+  pms5003t.newReading.dispatch();
+  co2.newReading.dispatch();
+  co2.commandDone.dispatch();
 }
 
-void Homectl::loop() {
-  state.blink.loop();
-  state.button.loop();
-  state.usbEcho.loop();
-  state.pms5003t.loop();
-  state.co2.loop();
+void Homectl::logSensors() {
+  LOG_AT(DEBUG, state.wakeups / double(secsPerLog),
+         F(" wake-ups per second"));
+  state.wakeups = 0;
+
+  state.co2.requestReading();
 
-  handleLoopTimer();
+  float const temperature = state.dht.readTemperature(false);
+  float const humidity = state.dht.readHumidity();
+  state.addClimateReading(Climate::SENSOR_DHT22, temperature, humidity);
 
-  delay(1);
+  state.lcd.setCursor(0, 1);
+  pad(state.lcd, state.lcd.printf("Temp: %.2fC", state.climate.temperature()));
+  state.lcd.setCursor(0, 2);
+  pad(state.lcd, state.lcd.printf("Hum: %.2f%%", state.climate.humidity()));
+}
+
+void Homectl::loop() {
+  // Sleeps until the next task is due, or the sensors sent something.
+  state.scheduler.loop();
+  ++state.wakeups;
 }
 
 // the setup routine runs once when you press reset:
 void Homectl::setup() {
   Logger<DEBUG>::setup();
 
-  state.dht.begin();
+  State &s = state;
+  s.co2Port.received.listen<State, &State::sensorReceived>(s).listen();
+  s.pms5003tPort.received.listen<State, &State::sensorReceived>(s).listen();
+  s.co2Port.begin(9600, Pins::CO2_RX, Pins::CO2_TX);
+  s.pms5003tPort.begin(9600, PMS5003T::RX_PIN, PMS5003T::TX_PIN);
+  s.dht.begin();
+
+  s.scheduler.clock().begin();
+  s.scheduler.every<Blink, &Blink::loop>(TASK_BLINK, s.blink, Blink::STEP_MS);
+  s.scheduler.every<PushButton, &PushButton::loop>(TASK_BUTTON, s.button,
+                                                   BUTTON_POLL_MS);
+  s.scheduler.every<UsbEcho, &UsbEcho::loop>(TASK_USB_ECHO, s.usbEcho,
+                                             USB_ECHO_POLL_MS);
+  s.scheduler.every<State, &State::pollSensors>(TASK_SENSORS, s,
+                                                SENSOR_POLL_MS);
+  s.scheduler.every<Homectl, &Homectl::logSensors>(TASK_LOG, *this,
+                                                   secsPerLog * 1000);
+  // The first measurements come in after a whole period.
+  s.scheduler.after(TASK_LOG, secsPerLog * 1000);
 
   if (DEBUG) {
     Serial.begin(9600);
+    Logger<DEBUG>::printCrashLog(Serial);
   }
 
   LOG(F("setup starting"));
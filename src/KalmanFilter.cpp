@@ -0,0 +1,51 @@
+#include "homectl/KalmanFilter.h"
+
+static constexpr bool testAveragesMeasurements() {
+  // Without drift, the filter is a running average.
+  KalmanFilter<1, double> f{{0}, {1e9}};
+  constexpr double zs[] = {20, 22, 21, 19, 23};
+  for (double z : zs) {
+    f.update({1}, z, 1);
+  }
+  return absolute(f[0] - 21) < 1e-6 && absolute(f.variance(0) - 0.2) < 1e-6;
+}
+
+static_assert(testAveragesMeasurements(), "testAveragesMeasurements failed");
+
+static constexpr bool testFollowsDrift() {
+  // Once the state is known well, the same measurement moves it further the
+  // more time has passed since the last one.
+  KalmanFilter<1, double> slow{{20}, {0.01}};
+  KalmanFilter<1, double> fast{{20}, {0.01}};
+  slow.predict({0.001}, 1);
+  fast.predict({0.001}, 100);
+  slow.update({1}, 21, 1);
+  fast.update({1}, 21, 1);
+  return slow[0] < fast[0] && fast[0] < 21;
+}
+
+static_assert(testFollowsDrift(), "testFollowsDrift failed");
+
+static constexpr bool testSeparatesOffset() {
+  // State: {temperature, offset of the second sensor}. The first sensor
+  // measures the temperature, the second one reads 3 degrees too high.
+  KalmanFilter<2, double> f{{0, 0}, {1e6, 1e6}};
+  for (int i = 0; i < 50; ++i) {
+    double const temperature = 20 + i * 0.1;
+    f.predict({0.1, 0}, 1);
+    f.update({1, 0}, temperature, 0.01);
+    f.update({1, 1}, temperature + 3, 0.01);
+  }
+  return absolute(f[0] - 24.9) < 0.1 && absolute(f[1] - 3) < 0.01;
+}
+
+static_assert(testSeparatesOffset(), "testSeparatesOffset failed");
+
+static constexpr bool testGateRejectsOutlier() {
+  KalmanFilter<1, double> f{{20}, {0.01}};
+  bool const rejected = !f.update({1}, 85, 0.04, 5);
+  bool const accepted = f.update({1}, 20.3, 0.04, 5);
+  return rejected && accepted && f[0] > 20 && f[0] < 20.3;
+}
+
+static_assert(testGateRejectsOutlier(), "testGateRejectsOutlier failed");
@@ -1,5 +1,7 @@
 #include "homectl/Logger.h"
 
+std::atomic<uint8_t> logThresholds[LOG_MODULE_COUNT] = {};
+
 template <>
 Logger<true>::LogQueue &Logger<true>::queue() {
   static LogQueue ob;
@@ -7,14 +9,91 @@ Logger<true>::LogQueue &Logger<true>::queue() {
 }
 
 template <>
-Print *&Logger<true>::output() {
-  static Print *ob = &Serial;
+Logger<true>::Sinks &Logger<true>::sinks() {
+  static Sinks ob{{&Serial}, 1};
   return ob;
 }
 
 template <>
 void Logger<true>::setOutput(Print &out) {
-  output() = &out;
+  sinks().out[0] = &out;
+}
+
+template <>
+bool Logger<true>::addSink(Print &out) {
+  Sinks &s = sinks();
+  if (s.count == Traits::MAX_SINKS) {
+    return false;
+  }
+  s.out[s.count++] = &out;
+  return true;
+}
+
+template <>
+void Logger<true>::removeSink(Print &out) {
+  Sinks &s = sinks();
+  for (int i = 1; i < s.count; ++i) {
+    if (s.out[i] == &out) {
+      std::copy(s.out + i + 1, s.out + s.count, s.out + i);
+      --s.count;
+      return;
+    }
+  }
+}
+
+template <>
+void Logger<true>::Batch::flush() {
+  if (size_ == 0) {
+    return;
+  }
+  Sinks const &s = sinks();
+  for (int i = 0; i < s.count; ++i) {
+    s.out[i]->write(data_, size_);
+  }
+  size_ = 0;
+}
+
+template <>
+size_t Logger<true>::Batch::write(uint8_t const *buffer, size_t size) {
+  size_t const written = size;
+  while (size > 0) {
+    size_t const n = std::min(size, sizeof data_ - size_);
+    memcpy(data_ + size_, buffer, n);
+    size_ += n;
+    buffer += n;
+    size -= n;
+    if (size_ == sizeof data_) {
+      flush();
+    }
+  }
+  return written;
+}
+
+template <>
+Logger<true>::Batch &Logger<true>::batch() {
+  // Static rather than on the writer's stack, since only one task flushes.
+  static Batch ob;
+  return ob;
+}
+
+// Not cleared on a soft reset, see LogRing.
+static RTC_NOINIT_ATTR LogRing<LoggerTraits::CRASH_LOG_SIZE>::Storage
+    crashLogStorage;
+
+template <>
+Logger<true>::CrashLog &Logger<true>::crashLog() {
+  static CrashLog ob(crashLogStorage);
+  return ob;
+}
+
+template <>
+void Logger<true>::printCrashLog(Print &out) {
+  if (crashLog().size() == 0) {
+    return;
+  }
+  out.println(F("--- log before reset ---"));
+  crashLog().printTo(out);
+  out.println(F("--- end of log before reset ---"));
 }
 
 template <>
@@ -24,26 +103,128 @@ TaskHandle_t &Logger<true>::task() {
 }
 
 template <>
-void Logger<true>::writeLines(void *) {
-  while (true) {
-    delay(Traits::DELAY);
-    if (output() == nullptr) {
-      continue;
-    }
+Logger<true>::Counters &Logger<true>::counters() {
+  static Counters ob;
+  return ob;
+}
 
-    int const queueSize = queue().size();
-    if (queueSize == Traits::BUFFER_LEN) {
-      Serial.println(
-          F("WARNING: Logger queue was full; you may have lost log lines"));
-    }
-    for (LogLine const &line : queue().consume()) {
-      if (line.empty()) {
-        break;
-      }
-      output()->write(line.data, line.cur - line.data);
-      output()->println();
+template <>
+LoggerStats Logger<true>::stats() {
+  Counters const &c = counters();
+  return {
+      c.droppedLines.load(std::memory_order_relaxed),
+      c.truncatedLines.load(std::memory_order_relaxed),
+      c.droppedBytes.load(std::memory_order_relaxed),
+      c.peakUsage.load(std::memory_order_relaxed),
+  };
+}
+
+template <>
+void Logger<true>::wakeWriter() {
+  if (task() != nullptr) {
+    xTaskNotifyGive(task());
+  }
+}
+
+template <>
+bool Logger<true>::waitForWriter(unsigned long start) {
+  if (task() == nullptr || millis() - start >= Traits::BLOCK_TIMEOUT) {
+    return false;
+  }
+  wakeWriter();
+  delay(1);
+  return true;
+}
+
+template <>
+size_t Logger<true>::printHeader(Print &out, LogSite const &site,
+                                 Time timestamp) {
+  size_t sz = 0;
+  sz += out.print(timestamp);
+  sz += out.print(' ');
+  sz += out.print(site.file);
+  sz += out.print(':');
+  sz += out.print(site.line);
+  sz += out.print(F(" ("));
+  sz += out.print(site.func);
+  sz += out.print(')');
+
+  // Headers are printed from both cores (deferred records are formatted on the
+  // writer core), so the running maximum needs to be atomic.
+  static std::atomic<size_t> maxLogPadding{0};
+  size_t padding = maxLogPadding.load(std::memory_order_relaxed);
+  while (sz >= padding) {
+    if (maxLogPadding.compare_exchange_weak(padding, sz + 1,
+                                            std::memory_order_relaxed)) {
+      padding = sz + 1;
     }
   }
+  while (sz < padding && out.write(' ') != 0) {
+    ++sz;
+  }
+  return sz;
+}
+
+template <>
+void Logger<true>::printRecord(Print &out, uint8_t const *data, size_t size) {
+  if (data[0] == RECORD_TEXT) {
+    out.write(data + 1, size - 1);
+    return;
+  }
+
+  DeferredHeader header;
+  memcpy(&header, data + 1, sizeof header);
+  printHeader(out, *header.site, Time(header.timestamp));
+  size_t const off = 1 + sizeof header;
+  size_t const argsSize = header.decode(out, data + off);
+  // Any plain text written after the arguments.
+  out.write(data + off + argsSize, size - off - argsSize);
+}
+
+template <>
+void Logger<true>::printQueued(Print &out) {
+  for (auto line = queue().front(); line.data != nullptr;
+       line = queue().front()) {
+    printRecord(out, line.data, line.size);
+    out.println();
+    queue().pop();
+  }
+}
+
+template <>
+void Logger<true>::flush() {
+  printQueued(batch());
+  batch().flush();
+}
+
+template <>
+void Logger<true>::reportDrops(Print &out) {
+  static LoggerStats reported{};
+  LoggerStats const current = stats();
+  if (current.droppedLines == reported.droppedLines &&
+      current.truncatedLines == reported.truncatedLines) {
+    return;
+  }
+  // Written straight to the output, since the queue may still be full, but
+  // with the same header as any other warning.
+  printHeader(out, *LOG_SITE(LOG_LEVEL_WARNING), Time(millis()));
+  out << F("Logger queue was full; dropped ")
+      << current.droppedLines - reported.droppedLines
+      << F(" lines, truncated ")
+      << current.truncatedLines - reported.truncatedLines << F(" lines, lost ")
+      << current.droppedBytes - reported.droppedBytes << F(" bytes");
+  out.println();
+  reported = current;
+}
+
+template <>
+void Logger<true>::writeLines(void *) {
+  while (true) {
+    // Sleep until a logger wakes us up, or until DELAY has passed.
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(Traits::DELAY));
+    reportDrops(batch());
+    flush();
+  }
 }
 
 template <>
@@ -51,9 +232,13 @@ void Logger<true>::setup() {
   // 1024 bytes ought to be enough for anybody (turns out, 640 is not).
   //
   // These 1024 bytes cover the stack requirements of writeLines locals and all
-  // the HardwareSerial/USB stuff happening below it. We copy the queue into a
-  // temporary, so we need to cover for that separately.
-  constexpr uint32_t STACK_SIZE = sizeof(queue()) + 1024;
+  // the HardwareSerial/USB stuff happening below it. Lines are formatted
+  // straight out of the queue into a static batch, so neither takes stack
+  // space. Deferred records are formatted here as well, so add another 1024
+  // for printf.
+  constexpr uint32_t STACK_SIZE = 2048;
+
+  addSink(crashLog());
 
   xTaskCreatePinnedToCore(writeLines, /* Function to implement the task */
                           "Logger",   /* Name of the task */
@@ -65,27 +250,75 @@ void Logger<true>::setup() {
 }
 
 template <>
-Logger<true>::Logger(__FlashStringHelper const *file, int line,
-                     char const *func, Time timestamp) {
-  String fileName(file);
-  int idx = fileName.lastIndexOf('/');
-  if (idx == -1) idx = fileName.lastIndexOf('\\');
-  if (idx != -1) fileName = fileName.substring(idx + 1);
+void Logger<true>::begin() {
+  started_ = true;
+  unsigned long const start = millis();
+  line_ = queue().begin();
+  while (!line_.valid && Traits::OVERFLOW_POLICY == LOG_BLOCK &&
+         waitForWriter(start)) {
+    line_ = queue().begin();
+  }
+}
 
-  size_t sz = 0;
-  sz += print(timestamp);
-  sz += print(' ');
-  sz += print(fileName);
-  sz += print(':');
-  sz += print(line);
-  sz += print(F(" ("));
-  sz += print(func);
-  sz += print(')');
-  static size_t maxLogPadding = 0;
-  if (sz >= maxLogPadding) {
-    maxLogPadding = sz + 1;
-  }
-  while (sz < maxLogPadding && sz < Traits::LINE_LEN) {
-    sz += print(' ');
+template <>
+size_t Logger<true>::overflow(uint8_t const *buffer, size_t size) {
+  if (dropped_ == 0 && line_.valid && Traits::OVERFLOW_POLICY == LOG_BLOCK) {
+    unsigned long const start = millis();
+    while (waitForWriter(start)) {
+      if (queue().put(line_, buffer, size)) {
+        return size;
+      }
+    }
+  }
+  if (line_.valid && (deferred_ || line_.size() == 0)) {
+    // A partial binary record can't be decoded, so drop all of it.
+    dropped_ += line_.size();
+    line_.valid = false;
   }
+  // Text lines are truncated at the first write that doesn't fit, so we don't
+  // end up with a hole in the middle of the line.
+  dropped_ += size;
+  return 0;
+}
+
+template <>
+void Logger<true>::finish() {
+  Counters &c = counters();
+  started_ = false;
+  if (!line_.valid || line_.size() == 0) {
+    c.droppedLines.fetch_add(1, std::memory_order_relaxed);
+    c.droppedBytes.fetch_add(dropped_, std::memory_order_relaxed);
+    return;
+  }
+
+  queue().commit(line_);
+  if (dropped_ != 0) {
+    c.truncatedLines.fetch_add(1, std::memory_order_relaxed);
+    c.droppedBytes.fetch_add(dropped_, std::memory_order_relaxed);
+  }
+
+  uint32_t const used = queue().used();
+  if (used > c.peakUsage.load(std::memory_order_relaxed)) {
+    c.peakUsage.store(used, std::memory_order_relaxed);
+  }
+  if (urgent_ || used >= Traits::HIGH_WATER) {
+    wakeWriter();
+  }
+}
+
+template <>
+Logger<true>::Logger(LogSite const &site, Time timestamp)
+    : urgent_(site.level >= LOG_LEVEL_WARNING) {
+  begin();
+  write(RECORD_TEXT);
+  printHeader(*this, site, timestamp);
+}
+
+template <>
+Logger<true>::Logger(LogDecoder decode, LogSite const &site, Time timestamp)
+    : deferred_(true), urgent_(site.level >= LOG_LEVEL_WARNING) {
+  begin();
+  DeferredHeader const header{decode, &site, timestamp.currTime};
+  write(RECORD_DEFERRED);
+  write(reinterpret_cast<uint8_t const *>(&header), sizeof header);
 }
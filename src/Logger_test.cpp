@@ -2,6 +2,8 @@
 
 #include "homectl/unittest.h"
 
+LOG_MODULE(TEST);
+
 class StringPrint : public Print {
   String str_;
 
@@ -14,11 +16,326 @@ class StringPrint : public Print {
   String const &str() const { return str_; }
 };
 
+class NullPrint : public Print {
+ public:
+  size_t write(uint8_t b) override { return 1; }
+};
+
+static constexpr LogSite testSite{"file.cpp", "myfunc", 123, LOG_LEVEL_INFO};
+
+TEST(Logger, Basename) {
+  static constexpr char path[] = "src/dir/file.cpp";
+  static_assert(logBasename(path) == path + 8, "not computed at compile time");
+  EXPECT_EQ(String(logBasename("C:\\src\\file.cpp")), "file.cpp");
+  EXPECT_EQ(String(logBasename("file.cpp")), "file.cpp");
+  EXPECT_EQ(String(LOG_SITE(LOG_LEVEL_INFO)->file), "Logger_test.cpp");
+}
+
+// Without the allocator wrappers nothing is counted, so this would always pass.
+#ifdef COUNT_ALLOCATIONS
+TEST(Logger, NoAllocations) {
+  NullPrint out;
+  Logger<true>::setOutput(out);
+
+  uint32_t const before = UnitTest::allocations();
+  doLogEager<true>(testSite, F("reading: "), 123, F(", temp: "), 23.5);
+  doLogfEager<true>(testSite, F("status: %02X"), 0xab);
+  doLogDeferred<true>(testSite, F("reading: "), 123, F(", temp: "), 23.5);
+  doLogfDeferred<true>(testSite, F("status: %02X"), 0xab);
+  Logger<true>::flush();
+  EXPECT_EQ(UnitTest::allocations() - before, 0);
+
+  Logger<true>::setOutput(Serial);
+}
+#endif
+
 TEST(Print, Logger) {
-  Logger<true> logger(F("file.cpp"), 123, "myfunc", Time(1234));
-  doPrint(logger, "hello ", 123, ' ', 2.34);
   StringPrint out;
   Logger<true>::setOutput(out);
-  EXPECT_EQ(out.str(), "[0:01.234] file.cpp:123 (myfunc) hello 123 2.34");
+  {
+    Logger<true> logger(testSite, Time(1234));
+    doPrint(logger, "hello ", 123, ' ', 2.34);
+  }
+  Logger<true>::flush();
+  EXPECT_EQ(out.str(), "[0:01.234] file.cpp:123 (myfunc) hello 123 2.34\r\n");
+  Logger<true>::setOutput(Serial);
+}
+
+TEST(Logger, DeferredMatchesEager) {
+  StringPrint eager;
+  Logger<true>::setOutput(eager);
+  {
+    Logger<true> logger(testSite, Time(1234));
+    doPrint(logger, "hello ", 123, ' ', 2.34, F(" flash"));
+    logger.print(" tail");
+  }
+  Logger<true>::flush();
+
+  StringPrint deferred;
+  Logger<true>::setOutput(deferred);
+  {
+    using Log =
+        DeferredLog<char const[7], int, char, double, __FlashStringHelper const *>;
+    Logger<true> logger(&Log::decode, testSite, Time(1234));
+    Log::encode(logger, "hello ", 123, ' ', 2.34, F(" flash"));
+    logger.print(" tail");
+  }
+  Logger<true>::flush();
+  EXPECT_EQ(deferred.str(), eager.str());
+  Logger<true>::setOutput(Serial);
+}
+
+TEST(Logger, DeferredCopiesCharArrays) {
+  StringPrint out;
+  Logger<true>::setOutput(out);
+  {
+    using Log = DeferredLog<char const[6]>;
+    Logger<true> logger(&Log::decode, testSite, Time(1234));
+    char name[] = "hello";
+    Log::encode(logger, const_cast<char const(&)[6]>(name));
+    // Formatting happens later, after the array has changed.
+    name[0] = 'j';
+  }
+  Logger<true>::flush();
+  EXPECT_EQ(out.str(), "[0:01.234] file.cpp:123 (myfunc) hello\r\n");
+  Logger<true>::setOutput(Serial);
+}
+
+TEST(Logger, DeferredLogfMatchesEager) {
+  StringPrint eager;
+  Logger<true>::setOutput(eager);
+  {
+    Logger<true> logger(testSite, Time(1234));
+    logger.printf("%02X %d %.1f %s", 0xab, -5, 1.5, "abc");
+  }
+  Logger<true>::flush();
+
+  StringPrint deferred;
+  Logger<true>::setOutput(deferred);
+  {
+    using Log = DeferredLogf<int, int, double, char const[4]>;
+    Logger<true> logger(&Log::decode, testSite, Time(1234));
+    Log::encode(logger, F("%02X %d %.1f %s"), 0xab, -5, 1.5, "abc");
+  }
+  Logger<true>::flush();
+  EXPECT_EQ(deferred.str(), eager.str());
+  Logger<true>::setOutput(Serial);
+}
+
+TEST(Logger, DeferredBenchmark) {
+  NullPrint out;
+  Logger<true>::setOutput(out);
+
+  // Log in batches that fit into the queue, flushing in between so we don't
+  // measure dropped lines.
+  constexpr int BATCHES = 10;
+  constexpr int BATCH_SIZE = 10;
+  unsigned long eager = 0;
+  unsigned long deferred = 0;
+  for (int i = 0; i < BATCHES; ++i) {
+    unsigned long start = micros();
+    for (int j = 0; j < BATCH_SIZE; ++j) {
+      doLogEager<true>(testSite, F("reading: "), j, F(", temp: "), 23.5);
+    }
+    eager += micros() - start;
+    Logger<true>::flush();
+
+    start = micros();
+    for (int j = 0; j < BATCH_SIZE; ++j) {
+      doLogDeferred<true>(testSite, F("reading: "), j, F(", temp: "), 23.5);
+    }
+    deferred += micros() - start;
+    Logger<true>::flush();
+  }
+
+  constexpr int N = BATCHES * BATCH_SIZE;
+  testInfo("eager: ", eager * 1000 / N, "ns/LOG, deferred: ",
+           deferred * 1000 / N, "ns/LOG");
+  Logger<true>::setOutput(Serial);
+}
+
+TEST(Logger, LinesPerBuffer) {
+  // The fixed-size line buffer used to hold 10 lines of up to 128 bytes in the
+  // same memory.
+  RecordQueue<LoggerTraits::BUFFER_SIZE> queue;
+  static_assert(sizeof queue == 1328, "log buffer grew");
+
+  char const line[] = "[0:12.345] Button.cpp:15 (loop)        button switched";
+  int lines = 0;
+  while (true) {
+    auto w = queue.begin();
+    bool fits = w.valid;
+    for (char c : line) {
+      fits = fits && queue.put(w, c);
+    }
+    if (!fits) {
+      break;
+    }
+    queue.commit(w);
+    ++lines;
+  }
+  EXPECT_EQ(lines, 23);
+}
+
+class LineCounter : public Print {
+  int lines_ = 0;
+
+ public:
+  size_t write(uint8_t b) override {
+    lines_ += b == '\n';
+    return 1;
+  }
+
+  int lines() const { return lines_; }
+};
+
+TEST(Logger, DropAccounting) {
+  LineCounter out;
+  Logger<true>::setOutput(out);
+  Logger<true>::flush();
+  LoggerStats const before = Logger<true>::stats();
+
+  // Deferred records are all-or-nothing, so every line either makes it or is
+  // counted as dropped.
+  constexpr int LINES = 100;
+  for (int i = 0; i < LINES; ++i) {
+    doLogDeferred<true>(testSite, F("line "), i);
+  }
+  // Depending on the space left, this is either truncated or dropped.
+  doLogEager<true>(testSite, F("this line doesn't fit"));
+  Logger<true>::flush();
+
+  LoggerStats const after = Logger<true>::stats();
+  int const dropped = after.droppedLines - before.droppedLines;
+  EXPECT_EQ(dropped > 0, true);
+  EXPECT_EQ(out.lines() + dropped, LINES + 1);
+  EXPECT_EQ(after.droppedBytes > before.droppedBytes, true);
+  EXPECT_EQ(after.peakUsage > LoggerTraits::BUFFER_SIZE - 64, true);
+
+  Logger<true>::setOutput(Serial);
+}
+
+static int evaluations = 0;
+
+static int countEvaluation() { return ++evaluations; }
+
+TEST(Logger, LevelsCompiledOut) {
+  static_assert(!LogCompiledIn<LOG_LEVEL_DEBUG, LOG_MODULE_TEST>::value,
+                "debug logging in tests should be compiled out");
+  static_assert(
+      LogCompiledIn<LOG_LEVEL_WARNING, LOG_MODULE_HOMECTL>::value == DEBUG,
+      "warnings should only depend on DEBUG");
+
+  evaluations = 0;
+  LOG_AT(DEBUG, F("evaluated "), countEvaluation());
+  LOGF_AT(DEBUG, F("evaluated %d"), countEvaluation());
+  EXPECT_EQ(evaluations, 0);
+}
+
+TEST(Logger, RuntimeLevels) {
+  EXPECT_EQ(logLevelEnabled(LOG_LEVEL_INFO, LOG_MODULE_TEST), true);
+  setLogLevel(LOG_MODULE_TEST, LOG_LEVEL_WARNING);
+  EXPECT_EQ(logLevelEnabled(LOG_LEVEL_INFO, LOG_MODULE_TEST), false);
+  EXPECT_EQ(logLevelEnabled(LOG_LEVEL_ERROR, LOG_MODULE_TEST), true);
+  EXPECT_EQ(logLevelEnabled(LOG_LEVEL_INFO, LOG_MODULE_CO2), true);
+
+  evaluations = 0;
+  LOG_AT(INFO, F("evaluated "), countEvaluation());
+  EXPECT_EQ(evaluations, 0);
+
+  // Measure what a suppressed call site costs.
+  constexpr int N = 1000;
+  unsigned long const start = micros();
+  for (int i = 0; i < N; ++i) {
+    LOG_AT(INFO, F("suppressed "), i);
+  }
+  unsigned long const suppressed = micros() - start;
+  testInfo("suppressed LOG: ", suppressed * 1000 / N, "ns");
+
+  setLogLevel(LOG_MODULE_TEST, LOG_LEVEL_DEBUG);
+}
+
+TEST(LogRing, KeepsNewest) {
+  LogRing<8>::Storage storage;
+  storage.magic = 0;  // As after power-on.
+  LogRing<8> ring(storage);
+  EXPECT_EQ(ring.size(), 0);
+
+  ring.print("abcde");
+  ring.print("fghij");
+  EXPECT_EQ(ring.size(), 8);
+  StringPrint out;
+  ring.printTo(out);
+  EXPECT_EQ(out.str(), "cdefghij");
+
+  // A write larger than the ring only keeps its end.
+  ring.print("0123456789");
+  StringPrint out2;
+  ring.printTo(out2);
+  EXPECT_EQ(out2.str(), "23456789");
+}
+
+TEST(LogRing, SurvivesReset) {
+  LogRing<8>::Storage storage;
+  storage.magic = 0;
+  {
+    LogRing<8> ring(storage);
+    ring.print("crash");
+  }
+
+  // A new ring on the same storage picks up where the old one left off.
+  LogRing<8> ring(storage);
+  StringPrint out;
+  ring.printTo(out);
+  EXPECT_EQ(out.str(), "crash");
+
+  storage.head = 100;
+  LogRing<8> corrupt(storage);
+  EXPECT_EQ(corrupt.size(), 0);
+}
+
+class TransactionCounter : public Print {
+  String str_;
+  int transactions_ = 0;
+
+ public:
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(uint8_t const *buffer, size_t size) override {
+    ++transactions_;
+    for (size_t i = 0; i < size; ++i) {
+      str_ += char(buffer[i]);
+    }
+    return size;
+  }
+
+  String const &str() const { return str_; }
+  int transactions() const { return transactions_; }
+};
+
+TEST(Logger, BatchedSinks) {
+  TransactionCounter out;
+  TransactionCounter extra;
+  Logger<true>::setOutput(out);
+  Logger<true>::flush();
+  EXPECT_EQ(Logger<true>::addSink(extra), true);
+
+  constexpr int LINES = 20;
+  for (int i = 0; i < LINES; ++i) {
+    doLogDeferred<true>(testSite, F("reading: "), i, F(", temp: "), 23.5);
+  }
+  Logger<true>::flush();
+  Logger<true>::removeSink(extra);
+
+  EXPECT_EQ(out.str(), extra.str());
+  // Used to be at least two writes (the line and its newline) per line.
+  EXPECT_EQ(out.transactions() <= LINES / 4, true);
+  testInfo(LINES, " lines in ", out.transactions(), " writes, ",
+           out.str().length() / out.transactions(), " bytes per write");
+
+  // Removed sinks don't get any more lines.
+  doLogEager<true>(testSite, F("only to out"));
+  Logger<true>::flush();
+  EXPECT_EQ(out.str().length() > extra.str().length(), true);
+
   Logger<true>::setOutput(Serial);
 }
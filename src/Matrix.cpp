@@ -4,7 +4,8 @@
 
 #include "homectl/Print.h"
 
-void printMatrix(Print &out, int rows, int cols, double const *data) {
+template <typename T>
+static void printMatrixImpl(Print &out, int rows, int cols, T const *data) {
   out << "Matrix<" << rows << ", " << cols << ">{{\n";
   for (int i = 0; i < rows; ++i) {
     out << "  {";
@@ -19,14 +20,30 @@ void printMatrix(Print &out, int rows, int cols, double const *data) {
   out << "}}";
 }
 
-void printLinearFunction(Print &out, int vars, double const *data) {
+void printMatrix(Print &out, int rows, int cols, double const *data) {
+  printMatrixImpl(out, rows, cols, data);
+}
+
+void printMatrix(Print &out, int rows, int cols, float const *data) {
+  printMatrixImpl(out, rows, cols, data);
+}
+
+template <typename T>
+static void printLinearFunctionImpl(Print &out, int vars, T const *data) {
   out << data[0];
   for (int i = 0; i < vars; ++i) {
     out << " + " << data[i + 1] << "x" << (i + 1);
   }
 }
 
-#if 0
+void printLinearFunction(Print &out, int vars, double const *data) {
+  printLinearFunctionImpl(out, vars, data);
+}
+
+void printLinearFunction(Print &out, int vars, float const *data) {
+  printLinearFunctionImpl(out, vars, data);
+}
+
 void testMatrixTranspose() {
   constexpr Matrix<3, 2> m = {{
       {1, 2},
@@ -67,7 +84,7 @@ void testMatrixInverse2x2() {
       {0.6, -0.7},
       {-0.2, 0.4},
   }};
-  static_assert(inverse(X) == X_inv, "Inverse function failed");
+  static_assert(roundBy(inverse(X), 100) == X_inv, "Inverse function failed");
 }
 
 void testMatrixInverse3x3() {
@@ -85,6 +102,20 @@ void testMatrixInverse3x3() {
   static_assert(roundBy(inv, 100) == X_inv, "Inverse function failed");
 }
 
+void testSolveSymmetric() {
+  constexpr Matrix<3, 3> A{{
+      {4, 12, -16},
+      {12, 37, -43},
+      {-16, -43, 98},
+  }};
+  constexpr Matrix<3, 1> b{{{1}, {2}, {3}}};
+  static_assert(roundBy(A * solveSymmetric(A, b), 1000) == b,
+                "solveSymmetric failed");
+  static_assert(roundBy(solveSymmetric(A, b), 1000) ==
+                    roundBy(inverse(A) * b, 1000),
+                "solveSymmetric disagrees with inverse");
+}
+
 void testMatrixSlice() {
   constexpr Matrix<3, 3> X{{
       {5, 7, 9},
@@ -121,18 +152,20 @@ void testSimpleLinearFunction() {
       {2, 1.5},
       {3, 3.5},
   }};
-  static_assert(roundBy(f.beta, 100) == Matrix<2, 1>{{{-0.5}, {1.25}}});
+  static_assert(roundBy(f.beta, 100) == Matrix<2, 1>{{{-0.5}, {1.25}}},
+                "Linear function computed incorrectly");
 }
 
 void testSimple2VarLinearFunction() {
-  // y = -1300 + -50 x1 + 0 x2
+  // y = -4100 + -100 x1 + 300 x2
   constexpr LinearFunction<2> f{{
       {15, 20, 400},
       {7, 17, 300},
       {2, 15, 200},
   }};
   static_assert(roundBy(f.beta, 100) ==
-                Matrix<3, 1>{{{-4146.88}, {-101.10}, {303.27}}});
+                    Matrix<3, 1>{{{-4100}, {-100}, {300}}},
+                "Linear function computed incorrectly");
 }
 
 void testLinearFunction() {
@@ -143,7 +176,24 @@ void testLinearFunction() {
       {728, 1043},
       {855, 1320},
   }};
-  static_assert(roundBy(f.beta, 100) == Matrix<2, 1>{{{-474.88}, {2.09}}});
+  static_assert(roundBy(f.beta, 100) == Matrix<2, 1>{{{-474.88}, {2.09}}},
+                "Linear function computed incorrectly");
   static_assert(roundBy(f(0), 100) == -474.88, "");
 }
-#endif
+
+static constexpr LinearFunction<2> fitManyRows(int rows) {
+  // y = 3 + 2 x1 - x2
+  LinearFunction<2>::Fit fit;
+  for (int i = 0; i < rows; ++i) {
+    double const x1 = i % 37;
+    double const x2 = i % 11;
+    LinearFunction<2>::addRow(fit, {{x1, x2, 3 + 2 * x1 - x2}});
+  }
+  return LinearFunction<2>(fit);
+}
+
+void testLinearFunctionManyRows() {
+  constexpr auto f = fitManyRows(5000);
+  static_assert(roundBy(f.beta, 1000) == Matrix<3, 1>{{{3}, {2}, {-1}}},
+                "Linear function computed incorrectly");
+}
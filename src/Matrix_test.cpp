@@ -0,0 +1,144 @@
+#include "homectl/Matrix.h"
+
+#include <math.h>
+
+#include "homectl/CO2Calibration.h"
+#include "homectl/FixedPointFunction.h"
+#include "homectl/PolynomialFunction.h"
+#include "homectl/RobustFit.h"
+#include "homectl/unittest.h"
+
+// Keeps the benchmark loops from being optimised out.
+static volatile double sink;
+
+TEST(LinearFunction, FloatAccuracy) {
+  constexpr LinearFunction<2> reference{co2Calibration};
+  constexpr LinearFunction<2, float> narrowed{co2Calibration};
+  static_assert(sizeof narrowed.beta == sizeof(float) * 3,
+                "narrowed beta should only hold floats");
+
+  double maxError = 0;
+  for (auto const &row : co2Calibration) {
+    double const error =
+        fabs(narrowed(row[0], row[1]) - reference(row[0], row[1]));
+    if (error > maxError) {
+      maxError = error;
+    }
+  }
+  // Way below the 1ppm resolution of the sensor.
+  EXPECT_EQ(maxError < 0.01, true);
+
+  constexpr int N = 10000;
+  unsigned long start = micros();
+  for (int i = 0; i < N; ++i) {
+    sink = reference(15 + i % 8, 400 + i % 500);
+  }
+  unsigned long const doubleNs = (micros() - start) * 1000 / N;
+  start = micros();
+  for (int i = 0; i < N; ++i) {
+    sink = narrowed(15 + i % 8, 400 + i % 500);
+  }
+  unsigned long const floatNs = (micros() - start) * 1000 / N;
+
+  testInfo("max float error: ", maxError * 1e6, "e-6 ppm; double: ", doubleNs,
+           "ns, float: ", floatNs, "ns per evaluation");
+}
+
+TEST(Matrix, SingularSystem) {
+  Matrix<2, 2> const A{{
+      {1, 2},
+      {2, 4},
+  }};
+  Matrix<2, 1> const b{{{1}, {2}}};
+  EXPECT_EQ(isnan(solveSymmetric(A, b)[0][0]), true);
+  EXPECT_EQ(isnan(inverse(A)[0][0]), true);
+}
+
+TEST(LinearFunction, RuntimeFit) {
+  constexpr LinearFunction<2> reference{co2Calibration};
+
+  LinearFunction<2>::Fit fit;
+  for (auto const &row : co2Calibration) {
+    LinearFunction<2>::addRow(fit, row);
+  }
+  LinearFunction<2> const f(fit);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(fabs(f.beta[i][0] - reference.beta[i][0]) < 1e-9, true);
+  }
+}
+
+TEST(FixedPointFunction, Benchmark) {
+  constexpr LinearFunction<2> reference{co2Calibration};
+  constexpr LinearFunction<2, float> narrowed{reference};
+  constexpr FixedPointFunction<2> fixed{reference, {{50, 5000}}};
+
+  constexpr int N = 10000;
+  unsigned long start = micros();
+  for (int i = 0; i < N; ++i) {
+    sink = narrowed(15 + i % 8, 400 + i % 500);
+  }
+  unsigned long const floatNs = (micros() - start) * 1000 / N;
+  start = micros();
+  for (int i = 0; i < N; ++i) {
+    sink = fixed(15 + i % 8, 400 + i % 500);
+  }
+  unsigned long const fixedNs = (micros() - start) * 1000 / N;
+
+  testInfo("Q", fixed.frac(), " fixed point: ", fixedNs, "ns, float: ",
+           floatNs, "ns per evaluation");
+}
+
+template <typename F>
+static double rmsResidual(F const &f) {
+  double sum = 0;
+  for (auto const &row : co2Calibration) {
+    double const residual = f(row[0], row[1]) - row[2];
+    sum += residual * residual;
+  }
+  return sqrt(sum / (sizeof co2Calibration / sizeof co2Calibration[0]));
+}
+
+TEST(PolynomialFunction, FitsBetterThanLinear) {
+  constexpr LinearFunction<2> linear{co2Calibration};
+  constexpr PolynomialFunction<2, 2> quadratic{co2Calibration};
+  constexpr PolynomialFunction<2, 3> cubic{co2Calibration};
+  constexpr PolynomialFunction<2, 2, float> narrowed{
+      PolynomialFunction<2, 2>::fit(co2Calibration)};
+
+  double const linearRms = rmsResidual(linear);
+  double const quadraticRms = rmsResidual(quadratic);
+  double const cubicRms = rmsResidual(cubic);
+  // Each model includes the previous one, so can only fit better.
+  EXPECT_EQ(quadraticRms <= linearRms, true);
+  EXPECT_EQ(cubicRms <= quadraticRms, true);
+  EXPECT_EQ(fabs(rmsResidual(narrowed) - quadraticRms) < 0.1, true);
+  testInfo("RMS residual: linear ", linearRms, "ppm, quadratic ", quadraticRms,
+           "ppm, cubic ", cubicRms, "ppm");
+}
+
+template <typename F>
+static double medianResidual(F const &f) {
+  constexpr int N = sizeof co2Calibration / sizeof co2Calibration[0];
+  double residuals[N];
+  for (int i = 0; i < N; ++i) {
+    auto const &row = co2Calibration[i];
+    residuals[i] = fabs(f(row[0], row[1]) - row[2]);
+  }
+  return medianInPlace(residuals, N);
+}
+
+TEST(RobustFit, CalibrationTable) {
+  constexpr LinearFunction<2> ordinary{co2Calibration};
+  constexpr LinearFunction<2> huber{
+      robustFit<LinearFunction<2>>(co2Calibration, ROBUST_HUBER)};
+  constexpr LinearFunction<2> tukey{
+      robustFit<LinearFunction<2>>(co2Calibration, ROBUST_TUKEY)};
+
+  // The robust fits trade a worse fit on the outliers for a better one on the
+  // rest of the table.
+  EXPECT_EQ(medianResidual(huber) <= medianResidual(ordinary), true);
+  EXPECT_EQ(medianResidual(tukey) <= medianResidual(ordinary), true);
+  testInfo("median residual: ordinary ", medianResidual(ordinary),
+           "ppm, Huber ", medianResidual(huber), "ppm, Tukey ",
+           medianResidual(tukey), "ppm");
+}
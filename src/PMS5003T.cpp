@@ -1,152 +1,213 @@
 #include "homectl/PMS5003T.h"
 
 #include "homectl/Logger.h"
+#include "homectl/Scheduler.h"
 #include "homectl/UART.h"
 
-constexpr byte INIT_BYTE1 = 0x42;
-constexpr byte INIT_BYTE2 = 0x4d;
-constexpr byte RESPONSE_LEN = 28;
+LOG_MODULE(PMS5003T);
 
-template <int N>
-static uint16_t getPms5003Checksum(byte const (&payload)[N]) {
-  uint16_t checksum = 0;
-  for (uint8_t i = 0; i < N - 2; ++i) {
-    checksum += payload[i];
-  }
-  return checksum;
-}
+using Codec = FrameCodec<PMS5003TFraming>;
 
-PMS5003T::PMS5003T(HardwareSerial &io) : io_(io) {
-  io_.begin(9600, SERIAL_8N1, RX_PIN, TX_PIN);
-  timer_ = xTimerCreate(
-      "PMS5003", pdMS_TO_TICKS(10000), pdTRUE, this, [](TimerHandle_t timer) {
-        PMS5003T &self = *static_cast<PMS5003T *>(pvTimerGetTimerID(timer));
-        self.sleep(false);
-      });
+// Commands, with the data they take.
+constexpr byte COMMAND_READ = 0xe2;
+// 0: passive, 1: active.
+constexpr byte COMMAND_MODE = 0xe1;
+// 0: sleep, 1: wake up.
+constexpr byte COMMAND_SLEEP = 0xe4;
 
-  sleep(false);
-}
+// In passive mode, the sensor answers a read right away, so a sample that
+// takes longer than this got lost.
+constexpr unsigned long SAMPLE_TIMEOUT_MS = 1000;
 
-template <int SendSize>
-static void sendCommand(Stream &io, byte (&cmd)[SendSize], byte startByte) {
-  LOG(F("  >>"), Bytes(cmd));
-  uint16_t checksum = getPms5003Checksum(cmd);
-  cmd[SendSize - 2] = (checksum >> 8) & 0xff;
-  cmd[SendSize - 1] = (checksum & 0xff);
-  io.write(cmd, SendSize);
-}
+// Index of the signed temperature among the 16-bit fields of a measurement.
+constexpr int TEMPERATURE_FIELD = 10;
+
+constexpr PMS5003T::Schedule PMS5003T::DEFAULT_SCHEDULE;
 
-void PMS5003T::sendSleep(bool enabled) {
-  byte cmd[] = {INIT_BYTE1, INIT_BYTE2, 0xe4, 0x00, !enabled, 0x00, 0x00};
-  LOG("Setting PMS5003T sensor sleep mode to ", enabled);
+PMS5003T::PMS5003T(Stream &io) : PMS5003T(io, DEFAULT_SCHEDULE) {}
 
-  sendCommand(io_, cmd, INIT_BYTE1);
+PMS5003T::PMS5003T(Stream &io, Schedule const &schedule)
+    : io_(io), deadline_(millis()) {
+  setSchedule(schedule);
 }
 
-void PMS5003T::sleep(bool enabled) {
-  sleepCommand_ = enabled ? SLEEP_ENABLE : SLEEP_DISABLE;
-  if (enabled) {
-    // Sleep mode on; start the timer to wake the sensor back up.
-    xTimerStart(timer_, 0);
-  } else {
-    // Sensor is going to wake up, so stop telling it to.
-    xTimerStop(timer_, 0);
+void PMS5003T::setSchedule(Schedule const &schedule) {
+  schedule_ = schedule;
+  if (schedule_.samples > MAX_SAMPLES) {
+    schedule_.samples = MAX_SAMPLES;
+  } else if (schedule_.samples == 0) {
+    schedule_.samples = 1;
   }
 }
 
-static void skipGarbage(Stream &io, Print &&logger) {
-  while (io.available() != 0) {
-    logger.printf(" %02x", io.read());
-  }
+void PMS5003T::sendCommand(byte command, uint16_t data) {
+  byte cmd[] = {0x00, 0x00, command, byte(data >> 8), byte(data), 0x00, 0x00};
+  Codec::encode(cmd);
+  LOG_AT(DEBUG, F("  >>"), Bytes(cmd));
+  io_.write(cmd, sizeof cmd);
 }
 
-void PMS5003T::processOutput() {
-  switch (sleepCommand_) {
-    case SLEEP_NONE:
-      // No change.
-      break;
-    case SLEEP_ENABLE:
-      sendSleep(true);
-      break;
-    case SLEEP_DISABLE:
-      sendSleep(false);
-      break;
+void PMS5003T::wake(unsigned long now) {
+  LOG_AT(DEBUG, F("waking up PMS5003T sensor"));
+  sendCommand(COMMAND_SLEEP, 1);
+  // The sensor comes out of a power cycle in active mode, so say this on every
+  // wake-up rather than just once.
+  sendCommand(COMMAND_MODE, 0);
+
+  phase_ = PHASE_WARMING_UP;
+  cycleStart_ = now;
+  deadline_ = now + schedule_.warmUpMs;
+}
+
+void PMS5003T::requestSample(unsigned long now) {
+  if (awaitingSample_) {
+    LOG_AT(WARNING, F("no response to PMS5003T read command"));
+  }
+  // Give up on this cycle when half of the samples don't come.
+  if (requests_ >= 2 * schedule_.samples) {
+    finishCycle(now);
+    return;
   }
 
-  sleepCommand_ = SLEEP_NONE;
+  sendCommand(COMMAND_READ, 0);
+  awaitingSample_ = true;
+  ++requests_;
+  deadline_ = now + SAMPLE_TIMEOUT_MS;
 }
 
-void PMS5003T::processInput() {
-  if (io_.available() == 0) return;
+void PMS5003T::finishCycle(unsigned long now) {
+  if (sampleCount_ == 0) {
+    LOG_AT(WARNING, F("no PMS5003T samples in this cycle"));
+  } else if (!newReading.post(average())) {
+    LOG_AT(WARNING, F("dropped PMS5003T reading; "), newReading.dropped(),
+           F(" so far"));
+  }
 
-  byte const b1 = io_.read();
-  if (b1 != INIT_BYTE1) {
-    return skipGarbage(
-        io_, LOGF(F("Incorrect start byte 1 of PMS5003T reading: %02X"), b1));
+  sendCommand(COMMAND_SLEEP, 0);
+  phase_ = PHASE_SLEEPING;
+  awaitingSample_ = false;
+  requests_ = 0;
+  sampleCount_ = 0;
+  // The period counts from wake-up, so that slow samples don't make the
+  // cycle drift. If this cycle overran, the next one starts right away.
+  deadline_ = cycleStart_ + schedule_.periodMs;
+  if (deadlinePassed(now, deadline_)) {
+    deadline_ = now;
   }
-  byte const b2 = io_.read();
-  if (b2 != INIT_BYTE2) {
-    return skipGarbage(
-        io_, LOGF(F("Incorrect start byte 2 of PMS5003T reading: %02X"), b2));
+}
+
+/**
+ * Mean or median of n values, which are reordered.
+ */
+static int32_t averageOf(int32_t *values, int n,
+                         PMS5003T::Averaging averaging) {
+  if (averaging == PMS5003T::AVERAGE_MEAN) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; ++i) {
+      sum += values[i];
+    }
+    // Round to nearest, away from zero.
+    return (sum + (sum < 0 ? -n : n) / 2) / n;
   }
 
-  byte const lenHi = io_.read();
-  byte const lenLo = io_.read();
-  uint16_t const len = (uint16_t(lenHi) << 8) | lenLo;
+  // Insertion sort, since there are at most MAX_SAMPLES values.
+  for (int i = 1; i < n; ++i) {
+    int32_t const value = values[i];
+    int j = i;
+    for (; j > 0 && values[j - 1] > value; --j) {
+      values[j] = values[j - 1];
+    }
+    values[j] = value;
+  }
+  return n % 2 != 0 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
 
-  if (len == 4) {
-    // This is the response to sendSleep().
-    byte payload[4];
-    size_t const actualRead = io_.readBytes(payload, len);
-    if (actualRead != len) {
-      LOG(F("ERROR: couldn't read desired number of bytes: "), actualRead,
-          F(" but wanted "), len);
+PMS5003T::Reading PMS5003T::average() const {
+  byte payload[PMS5003TFraming::MEASUREMENT_LEN] = {};
+  for (int field = 0; field < FIELDS; ++field) {
+    int32_t values[MAX_SAMPLES];
+    for (int i = 0; i < sampleCount_; ++i) {
+      uint16_t const raw = samples_[i][field];
+      values[i] = field == TEMPERATURE_FIELD ? int16_t(raw) : raw;
     }
-    return;
+    writeBigEndian<uint16_t>(
+        &payload[2 * field],
+        uint16_t(averageOf(values, sampleCount_, schedule_.averaging)));
   }
+  return Reading(payload);
+}
 
-  if (len != RESPONSE_LEN) {
-    return skipGarbage(io_, LOG("Got unexpected payload length: ", len));
+void PMS5003T::receive() {
+  uint32_t const errors = parser_.errors().total();
+
+  // Take whatever has arrived, without waiting for more.
+  while (io_.available() > 0) {
+    parser_.push(io_.read(), [this](byte const *frame, int len) {
+      handleFrame(frame, len);
+    });
   }
 
-  byte payload[RESPONSE_LEN];
-  size_t const actualRead = io_.readBytes(payload, len);
-  if (actualRead != len) {
-    LOG(F("ERROR: couldn't read desired number of bytes: "), actualRead,
-        F(" but wanted "), len);
-    return;
+  if (parser_.errors().total() != errors) {
+    LOG_AT(WARNING, F("garbled PMS5003T output; so far "), parser_.errors());
   }
+}
 
-  Reading const reading(payload);
-  uint16_t const checksumRef =
-      getPms5003Checksum(payload) + INIT_BYTE1 + INIT_BYTE2 + RESPONSE_LEN;
-  if (reading.checksum != checksumRef) {
-    LOGF(F("ERROR: Checksum from PMS5003T didn't match: %d vs. %d (computed)"),
-         reading.checksum, checksumRef);
+void PMS5003T::handleFrame(byte const *frame, int len) {
+  LOG_AT(DEBUG, F("  <<"), Bytes(frame, len));
+  if (len != PMS5003TFraming::HEADER_LEN + PMS5003TFraming::MEASUREMENT_LEN) {
+    // This is the response to a sleep or mode command.
     return;
   }
-
-  LOG("\n  STD: PM1.0: ", reading.pm1_0_std, ", PM2.5: ", reading.pm2_5_std,
-      ", PM10: ", reading.pm10_std, "\n  ATM: PM1.0: ", reading.pm1_0_atm,
-      ", PM2.5: ", reading.pm2_5_atm, ", PM10: ", reading.pm10_atm,
-      "\n  CNT: PM0.3: ", reading.pm0_3_cnt, ", PM0.5: ", reading.pm0_5_cnt,
-      ", PM1.0: ", reading.pm1_0_cnt, ", PM2.5: ", reading.pm2_5_cnt,
-      "\n  Temp: ", float(reading.temp) / 10,
-      "C, Hum: ", float(reading.hum) / 10, '%');
-
-  if (reading.pm2_5_atm == 0) {
-    LOGF(F("WARNING: skipping zero reading from PM sensor"));
+  if (!awaitingSample_) {
+    // Still in active mode, e.g. right after power-up.
+    LOG_AT(DEBUG, F("ignoring unrequested PMS5003T measurement"));
     return;
   }
+  awaitingSample_ = false;
+  handleSample(frame + PMS5003TFraming::HEADER_LEN);
+
+  unsigned long const now = millis();
+  if (sampleCount_ >= schedule_.samples) {
+    finishCycle(now);
+  } else {
+    deadline_ = now + schedule_.settleMs;
+  }
+}
 
-  // Put the sensor to sleep, and start the timer for waking it up.
-  sleep(true);
-  return newReading(reading);
+void PMS5003T::handleSample(byte const *payload) {
+  Reading const reading(payload);
+  LOG_AT(DEBUG, "\n  STD: PM1.0: ", reading.pm1_0_std,
+         ", PM2.5: ", reading.pm2_5_std, ", PM10: ", reading.pm10_std,
+         "\n  ATM: PM1.0: ", reading.pm1_0_atm, ", PM2.5: ", reading.pm2_5_atm,
+         ", PM10: ", reading.pm10_atm, "\n  CNT: PM0.3: ", reading.pm0_3_cnt,
+         ", PM0.5: ", reading.pm0_5_cnt, ", PM1.0: ", reading.pm1_0_cnt,
+         ", PM2.5: ", reading.pm2_5_cnt, "\n  Temp: ", float(reading.temp) / 10,
+         "C, Hum: ", float(reading.hum) / 10, '%');
+
+  for (int field = 0; field < FIELDS; ++field) {
+    samples_[sampleCount_][field] =
+        readBigEndian<uint16_t>(&payload[2 * field]);
+  }
+  ++sampleCount_;
 }
 
 void PMS5003T::loop() {
-  processOutput();
-  processInput();
+  unsigned long const now = millis();
+  if (!deadlinePassed(now, deadline_)) return;
+
+  switch (phase_) {
+    case PHASE_SLEEPING:
+      wake(now);
+      break;
+    case PHASE_WARMING_UP:
+      phase_ = PHASE_SAMPLING;
+      requestSample(now);
+      break;
+    case PHASE_SAMPLING:
+      // Either the next sample is due, or the last one never came.
+      requestSample(now);
+      break;
+  }
 }
 
 size_t PMS5003T::Reading::printTo(Print &out) const {
@@ -0,0 +1,200 @@
+#include "homectl/PMS5003T.h"
+
+#include "homectl/FakeSerialPort.h"
+#include "homectl/unittest.h"
+
+class PMSListener {
+ public:
+  int readings = 0;
+  PMS5003T::Reading last;
+
+  void handle(PMS5003T::Reading const &reading) {
+    ++readings;
+    last = reading;
+  }
+};
+
+/**
+ * A measurement frame with the given PM2.5 value.
+ */
+static void makeFrame(byte (&frame)[32], uint16_t pm2_5) {
+  memset(frame, 0, sizeof frame);
+  frame[0] = 0x42;
+  frame[1] = 0x4d;
+  frame[3] = 28;
+  frame[12] = pm2_5 >> 8;
+  frame[13] = pm2_5 & 0xff;
+  uint16_t checksum = 0;
+  for (int i = 0; i < 30; ++i) {
+    checksum += frame[i];
+  }
+  frame[30] = checksum >> 8;
+  frame[31] = checksum & 0xff;
+}
+
+// Runs the same path as Homectl::State::pollSensors().
+static void pump(FakeSerialPort<> &port, PMS5003T &pms) {
+  if (port.takeRxEvent()) {
+    pms.receive();
+  }
+  pms.loop();
+  pms.newReading.dispatch();
+}
+
+/**
+ * One sample per reading, taken as soon as possible.
+ */
+static constexpr PMS5003T::Schedule FAST = {0, 0, 0, 1,
+                                            PMS5003T::AVERAGE_MEAN};
+
+// Size of a command frame.
+constexpr size_t COMMAND_LEN = 7;
+
+/**
+ * Run pms until it asks for a sample.
+ */
+static void awaitRequest(FakeSerialPort<> &port, PMS5003T &pms) {
+  // Wake up and set passive mode, then read.
+  for (int i = 0; i < 2; ++i) {
+    pump(port, pms);
+  }
+}
+
+TEST(PMS5003T, ReceivesInPieces) {
+  FakeSerialPort<> port;
+  PMSListener listener;
+  PMS5003T pms{
+      pms.newReading.listen<PMSListener, &PMSListener::handle>(listener), port,
+      FAST};
+
+  awaitRequest(port, pms);
+  byte frame[32];
+  makeFrame(frame, 12);
+  for (byte b : frame) {
+    port.feed(&b, 1);
+    pump(port, pms);
+  }
+  EXPECT_EQ(listener.readings, 1);
+  EXPECT_EQ(listener.last.pm2_5_atm, 12);
+  EXPECT_EQ(pms.errors().syncLosses, 0);
+}
+
+TEST(PMS5003T, CorruptFrameCostsOneReading) {
+  FakeSerialPort<> port;
+  PMSListener listener;
+  PMS5003T pms{
+      pms.newReading.listen<PMSListener, &PMSListener::handle>(listener), port,
+      FAST};
+
+  byte frame[32];
+  makeFrame(frame, 34);
+  byte corrupt[32];
+  memcpy(corrupt, frame, sizeof corrupt);
+  corrupt[20] ^= 0x01;
+
+  // The second frame follows right after the corrupt one, without a gap.
+  awaitRequest(port, pms);
+  port.feed(corrupt);
+  port.feed(frame);
+  pump(port, pms);
+  EXPECT_EQ(listener.readings, 1);
+  EXPECT_EQ(listener.last.pm2_5_atm, 34);
+  EXPECT_EQ(pms.errors().checksumFailures, 1);
+  EXPECT_EQ(pms.errors().syncLosses, 1);
+
+  // A bad length, and a lost byte in the header.
+  byte const badLength[] = {0x42, 0x4d, 0x00, 0x10};
+  byte const lostByte[] = {0x42, 0x00, 0x1c};
+  awaitRequest(port, pms);
+  port.feed(badLength);
+  port.feed(lostByte);
+  port.feed(frame);
+  pump(port, pms);
+  EXPECT_EQ(listener.readings, 2);
+  EXPECT_EQ(pms.errors().lengthErrors, 1);
+  EXPECT_EQ(pms.errors().syncLosses, 2);
+}
+
+TEST(PMS5003T, AveragesScheduledSamples) {
+  FakeSerialPort<> port;
+  PMSListener listener;
+  PMS5003T::Schedule const schedule{200, 20, 10, 3, PMS5003T::AVERAGE_MEDIAN};
+  PMS5003T pms{
+      pms.newReading.listen<PMSListener, &PMSListener::handle>(listener), port,
+      schedule};
+
+  // Wake up and switch to passive mode.
+  pump(port, pms);
+  EXPECT_EQ(port.written, 2 * COMMAND_LEN);
+
+  // Measurements sent before switching to passive mode are ignored.
+  byte frame[32];
+  makeFrame(frame, 99);
+  port.feed(frame);
+  pump(port, pms);
+  EXPECT_EQ(port.written, 2 * COMMAND_LEN);
+
+  // After warming up, each sample is asked for, with one outlier.
+  uint16_t const samples[] = {10, 50, 12};
+  delay(schedule.warmUpMs);
+  for (uint16_t pm2_5 : samples) {
+    pump(port, pms);
+    makeFrame(frame, pm2_5);
+    port.feed(frame);
+    pump(port, pms);
+    delay(schedule.settleMs);
+  }
+  // The three reads, and the command to go back to sleep.
+  EXPECT_EQ(port.written, 6 * COMMAND_LEN);
+  EXPECT_EQ(listener.readings, 1);
+  EXPECT_EQ(listener.last.pm2_5_atm, 12);
+
+  // Nothing happens until the next cycle.
+  pump(port, pms);
+  EXPECT_EQ(port.written, 6 * COMMAND_LEN);
+  delay(schedule.periodMs);
+  pump(port, pms);
+  EXPECT_EQ(port.written, 8 * COMMAND_LEN);
+}
+
+TEST(PMS5003T, ReportsCleanAir) {
+  FakeSerialPort<> port;
+  PMSListener listener;
+  PMS5003T::Schedule const schedule{0, 0, 0, 3, PMS5003T::AVERAGE_MEAN};
+  PMS5003T pms{
+      pms.newReading.listen<PMSListener, &PMSListener::handle>(listener), port,
+      schedule};
+
+  // Wake up, then take every sample at 0.
+  pump(port, pms);
+  byte frame[32];
+  makeFrame(frame, 0);
+  for (int i = 0; i < schedule.samples; ++i) {
+    pump(port, pms);
+    port.feed(frame);
+    pump(port, pms);
+  }
+  EXPECT_EQ(listener.readings, 1);
+  EXPECT_EQ(listener.last.pm2_5_atm, 0);
+}
+
+TEST(PMS5003T, FakePortDropsOverflow) {
+  FakeSerialPort<> port;
+  PMSListener listener;
+  PMS5003T pms{
+      pms.newReading.listen<PMSListener, &PMSListener::handle>(listener), port,
+      FAST};
+
+  // Five frames don't fit in 128 bytes; the last one is cut short.
+  awaitRequest(port, pms);
+  byte frame[32];
+  makeFrame(frame, 56);
+  for (int i = 0; i < 5; ++i) {
+    port.feed(frame);
+  }
+  EXPECT_EQ(port.overflows, 1);
+  EXPECT_EQ(port.available(), 128);
+  pump(port, pms);
+  EXPECT_EQ(listener.readings, 1);
+  EXPECT_EQ(listener.last.pm2_5_atm, 56);
+}
@@ -0,0 +1,37 @@
+#include "homectl/PolynomialFunction.h"
+
+#include "homectl/CO2Calibration.h"
+
+static_assert(polynomialTerms(2, 1) == 3, "polynomialTerms failed");
+static_assert(polynomialTerms(2, 2) == 6, "polynomialTerms failed");
+static_assert(polynomialTerms(3, 2) == 10, "polynomialTerms failed");
+
+static constexpr bool testPolynomialExactFit() {
+  // y = 1 + 2 x1 - x2 + 0.5 x1² - 3 x1 x2 + 0.25 x2²
+  constexpr PolynomialFunction<2, 2> f{{
+      {0, 0, 1},
+      {1, 0, 3.5},
+      {0, 1, 0.25},
+      {2, 0, 7},
+      {1, 1, -0.25},
+      {0, 2, 0},
+      {3, 1, 1.75},
+  }};
+  return roundBy(f(2, 3), 1000) == -11.75 && roundBy(f(-1, 4), 1000) == 11.5;
+}
+
+static_assert(testPolynomialExactFit(), "testPolynomialExactFit failed");
+
+static constexpr bool testPolynomialMatchesLinear() {
+  constexpr PolynomialFunction<2, 1> poly{co2Calibration};
+  constexpr LinearFunction<2> linear{co2Calibration};
+  return roundBy(poly(17, 600), 1000) == roundBy(linear(17, 600), 1000) &&
+         roundBy(poly(20, 800), 1000) == roundBy(linear(20, 800), 1000);
+}
+
+static_assert(testPolynomialMatchesLinear(),
+              "testPolynomialMatchesLinear failed");
+
+// Only the coefficients end up in the binary.
+static_assert(sizeof(PolynomialFunction<2, 2, float>) == sizeof(float) * 6,
+              "extra data unaccounted for in PolynomialFunction");
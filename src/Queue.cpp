@@ -52,3 +52,40 @@ static constexpr bool testQueueMove() {
 }
 
 static_assert(testQueueMove(), "testQueueMove failed");
+
+static constexpr bool testQueueWrapAround() {
+  Queue<int, 3> queue{1, 2, 3};
+
+  for (int i = 4; i < 10; ++i) {
+    if (queue.front() != i - 3) return false;
+    queue.pop();
+    if (!queue.push(int(i))) return false;
+    if (queue.size() != 3) return false;
+  }
+
+  int last = 6;
+  for (int v : queue) {
+    if (v != last + 1) return false;
+    last = v;
+  }
+  return last == 9;
+}
+
+static_assert(testQueueWrapAround(), "testQueueWrapAround failed");
+
+static constexpr bool testQueueDrainInto() {
+  Queue<int, 5> queue{1, 2, 3, 4, 5};
+  Queue<int, 3> out{0};
+
+  if (queue.drain_into(out) != 2) return false;
+  if (queue.size() != 3 || queue.front() != 3) return false;
+  out.pop();
+  if (out.front() != 1) return false;
+  out.clear();
+  if (queue.drain_into(out) != 3) return false;
+  if (!queue.empty() || out.size() != 3 || out.front() != 3) return false;
+
+  return true;
+}
+
+static_assert(testQueueDrainInto(), "testQueueDrainInto failed");
@@ -0,0 +1,195 @@
+#include "homectl/Queue.h"
+
+#include <Arduino.h>
+
+#include <thread>
+
+#include "homectl/unittest.h"
+
+TEST(SpscQueue, ReserveCommit) {
+  SpscQueue<int, 3> queue;
+  EXPECT_EQ(queue.front() == nullptr, true);
+
+  for (int i = 1; i <= 3; ++i) {
+    int *slot = queue.reserve();
+    EXPECT_EQ(slot != nullptr, true);
+    *slot = i;
+    queue.commit();
+  }
+  EXPECT_EQ(queue.size(), 3);
+  EXPECT_EQ(queue.reserve() == nullptr, true);
+
+  EXPECT_EQ(*queue.front(), 1);
+  queue.pop();
+  EXPECT_EQ(queue.add(4), true);
+  for (int i = 2; i <= 4; ++i) {
+    EXPECT_EQ(*queue.front(), i);
+    queue.pop();
+  }
+  EXPECT_EQ(queue.size(), 0);
+}
+
+namespace {
+
+struct Tracked {
+  static int alive;
+  static int moves;
+
+  int value;
+
+  explicit Tracked(int v) : value(v) { ++alive; }
+  Tracked(Tracked &&rhs) : value(rhs.value) {
+    ++alive;
+    ++moves;
+  }
+  ~Tracked() { --alive; }
+};
+
+int Tracked::alive = 0;
+int Tracked::moves = 0;
+
+}  // namespace
+
+TEST(Queue, ElementLifetime) {
+  {
+    Queue<Tracked, 100> queue;
+    EXPECT_EQ(Tracked::alive, 0);
+
+    for (int i = 0; i < 10; ++i) {
+      queue.push(Tracked(i));
+    }
+    EXPECT_EQ(Tracked::alive, 10);
+    queue.pop();
+    EXPECT_EQ(Tracked::alive, 9);
+
+    // Draining only touches the elements that are there.
+    Tracked::moves = 0;
+    Queue<Tracked, 100> out;
+    EXPECT_EQ(queue.drain_into(out), 9);
+    EXPECT_EQ(Tracked::moves, 9);
+    EXPECT_EQ(Tracked::alive, 9);
+    EXPECT_EQ(out.front().value, 1);
+
+    Queue<Tracked, 100> moved = std::move(out);
+    EXPECT_EQ(Tracked::moves, 18);
+    EXPECT_EQ(moved.size(), 9);
+  }
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+namespace {
+
+constexpr int STRESS_ITEMS = 20000;
+
+struct StressResult {
+  unsigned long totalMicros;
+  unsigned long maxAddMicros;
+  bool inOrder;
+};
+
+template <typename Add, typename Drain>
+StressResult stress(Add add, Drain drain) {
+  StressResult result{0, 0, true};
+  unsigned long const start = micros();
+
+  std::thread consumer([&] {
+    int expected = 0;
+    while (expected < STRESS_ITEMS) {
+      drain([&](int v) {
+        result.inOrder &= v == expected;
+        ++expected;
+      });
+      std::this_thread::yield();
+    }
+  });
+
+  for (int i = 0; i < STRESS_ITEMS; ++i) {
+    unsigned long const before = micros();
+    while (!add(i)) {
+      std::this_thread::yield();
+    }
+    unsigned long const elapsed = micros() - before;
+    if (elapsed > result.maxAddMicros) {
+      result.maxAddMicros = elapsed;
+    }
+  }
+
+  consumer.join();
+  result.totalMicros = micros() - start;
+  return result;
+}
+
+}  // namespace
+
+TEST(SpscQueue, StressAgainstMutex) {
+  static SpscQueue<int, 10> spsc;
+  StressResult const lockFree = stress(
+      [](int v) { return spsc.add(std::move(v)); },
+      [](auto f) {
+        while (int const *v = spsc.front()) {
+          f(*v);
+          spsc.pop();
+        }
+      });
+
+  static ThreadSafeQueue<int, 10> locked;
+  StressResult const mutex = stress(
+      [](int v) { return locked.add(std::move(v)); },
+      [](auto f) {
+        for (int v : locked.consume()) {
+          f(v);
+        }
+      });
+
+  EXPECT_EQ(lockFree.inOrder, true);
+  EXPECT_EQ(mutex.inOrder, true);
+  testInfo("spsc: ", lockFree.totalMicros, "us total, ", lockFree.maxAddMicros,
+           "us max add; mutex: ", mutex.totalMicros, "us total, ",
+           mutex.maxAddMicros, "us max add");
+}
+
+static void putRecord(RecordQueue<16> &queue, char const *str) {
+  auto w = queue.begin();
+  while (*str != '\0') {
+    queue.put(w, *str++);
+  }
+  queue.commit(w);
+}
+
+static String popRecord(RecordQueue<16> &queue) {
+  String str;
+  auto const entry = queue.front();
+  for (int i = 0; i < entry.size; ++i) {
+    str += char(entry.data[i]);
+  }
+  queue.pop();
+  return str;
+}
+
+TEST(RecordQueue, WrapAround) {
+  RecordQueue<16> queue;
+  EXPECT_EQ(queue.empty(), true);
+
+  putRecord(queue, "hello");  // [0, 7)
+  putRecord(queue, "world");  // [7, 14)
+  EXPECT_EQ(popRecord(queue), "hello");
+
+  // Doesn't fit in the 2 bytes left at the end, so it's moved to the start.
+  putRecord(queue, "wrap");
+  EXPECT_EQ(popRecord(queue), "world");
+  EXPECT_EQ(popRecord(queue), "wrap");
+  EXPECT_EQ(queue.empty(), true);
+}
+
+TEST(RecordQueue, Full) {
+  RecordQueue<16> queue;
+  auto w = queue.begin();
+  int written = 0;
+  while (queue.put(w, 'x')) {
+    ++written;
+  }
+  // 2 bytes of header, 1 byte to tell full from empty.
+  EXPECT_EQ(written, 13);
+  queue.commit(w);
+  EXPECT_EQ(queue.front().size, 13);
+}
@@ -0,0 +1 @@
+#include "homectl/RecursiveLeastSquares.h"
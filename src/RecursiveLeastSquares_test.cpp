@@ -0,0 +1,56 @@
+#include "homectl/RecursiveLeastSquares.h"
+
+#include <math.h>
+
+#include "homectl/CO2Calibration.h"
+#include "homectl/unittest.h"
+
+static constexpr LinearFunction<2> batch{co2Calibration};
+
+template <typename T>
+static double maxBetaError(RecursiveLeastSquares<2, T> const &rls) {
+  double maxError = 0;
+  for (int i = 0; i < 3; ++i) {
+    double const beta = batch.beta[i][0];
+    double const error = fabs(rls.state().beta[i][0] - beta) / fabs(beta);
+    if (error > maxError) {
+      maxError = error;
+    }
+  }
+  return maxError;
+}
+
+TEST(RecursiveLeastSquares, ConvergesToBatchFit) {
+  RecursiveLeastSquares<2, double> rls(1, 1e6);
+  for (auto const &row : co2Calibration) {
+    rls.update(row);
+  }
+  testInfo("relative beta error: ", maxBetaError(rls) * 1e6, "e-6");
+  EXPECT_EQ(maxBetaError(rls) < 1e-4, true);
+}
+
+TEST(RecursiveLeastSquares, FloatWarmStart) {
+  RecursiveLeastSquares<2> rls(LinearFunction<2>::fit(co2Calibration), 1);
+  EXPECT_EQ(maxBetaError(rls) < 1e-5, true);
+
+  // The same samples again don't change the least squares solution.
+  for (auto const &row : co2Calibration) {
+    rls.update({float(row[0]), float(row[1]), float(row[2])});
+  }
+  testInfo("relative beta error: ", maxBetaError(rls) * 1e6, "e-6");
+  EXPECT_EQ(maxBetaError(rls) < 1e-4, true);
+}
+
+TEST(RecursiveLeastSquares, FollowsDrift) {
+  RecursiveLeastSquares<2> rls(LinearFunction<2>::fit(co2Calibration), 0.95);
+
+  // The reference now reads 50ppm higher than the original fit.
+  for (int i = 0; i < 200; ++i) {
+    float const temp = 15 + i % 7;
+    float const ppm = 450 + (i * 37) % 400;
+    rls.update({temp, ppm, float(batch(temp, ppm)) + 50});
+  }
+  float const drift = rls(17, 600) - batch(17, 600);
+  testInfo("learned drift: ", drift, "ppm");
+  EXPECT_EQ(fabs(drift - 50) < 1, true);
+}
@@ -0,0 +1,68 @@
+#include "homectl/RobustFit.h"
+
+#include "homectl/PolynomialFunction.h"
+
+static constexpr bool testMedian() {
+  double odd[] = {5, 1, 4, 2, 3};
+  double even[] = {4, 1, 3, 2};
+  double same[] = {2, 2, 2};
+  return medianInPlace(odd, 5) == 3 && medianInPlace(even, 4) == 3 &&
+         medianInPlace(same, 3) == 2;
+}
+
+static_assert(testMedian(), "testMedian failed");
+
+// y = 3 + 2 x, with three bad readings.
+static constexpr MatrixRow<2> outliers[] = {
+    {0, 3},  {1, 5},   {2, 7},  {3, 9},  {4, 11}, {5, 13},  {6, 15},
+    {7, 17}, {8, 119}, {9, 21}, {10, 23}, {11, 25}, {12, 127}, {13, 29},
+    {14, 31}, {15, 33}, {16, 35}, {17, 137}, {18, 39}, {19, 41},
+};
+
+static constexpr bool testOutliersSkewOrdinaryFit() {
+  constexpr LinearFunction<1> f{outliers};
+  return !(roundBy(f.beta, 1) == Matrix<2, 1>{{{3}, {2}}});
+}
+
+static_assert(testOutliersSkewOrdinaryFit(),
+              "testOutliersSkewOrdinaryFit failed");
+
+static constexpr bool testTukeyIgnoresOutliers() {
+  constexpr LinearFunction<1> f{
+      robustFit<LinearFunction<1>>(outliers, ROBUST_TUKEY)};
+  return roundBy(f.beta, 1000) == Matrix<2, 1>{{{3}, {2}}};
+}
+
+static_assert(testTukeyIgnoresOutliers(), "testTukeyIgnoresOutliers failed");
+
+static constexpr bool testHuberDownweighsOutliers() {
+  constexpr LinearFunction<1> ordinary{outliers};
+  constexpr LinearFunction<1> f{
+      robustFit<LinearFunction<1>>(outliers, ROBUST_HUBER)};
+  return absolute(f.beta[1][0] - 2) < absolute(ordinary.beta[1][0] - 2) / 4 &&
+         absolute(f.beta[0][0] - 3) < absolute(ordinary.beta[0][0] - 3) / 4;
+}
+
+static_assert(testHuberDownweighsOutliers(),
+              "testHuberDownweighsOutliers failed");
+
+static constexpr bool testRobustPolynomial() {
+  // y = x², with one bad reading.
+  constexpr MatrixRow<2> rows[] = {
+      {-3, 9}, {-2, 4}, {-1, 1}, {0, 0}, {1, 1}, {2, 40}, {3, 9}, {4, 16},
+  };
+  constexpr PolynomialFunction<1, 2> f{
+      robustFit<PolynomialFunction<1, 2>>(rows, ROBUST_TUKEY)};
+  return roundBy(f(5), 1000) == 25;
+}
+
+static_assert(testRobustPolynomial(), "testRobustPolynomial failed");
+
+static constexpr bool testCallerScratch() {
+  double absResiduals[sizeof outliers / sizeof outliers[0]] = {};
+  return robustFit<LinearFunction<1>>(outliers, ROBUST_HUBER, absResiduals)
+             .solve() ==
+         robustFit<LinearFunction<1>>(outliers, ROBUST_HUBER).solve();
+}
+
+static_assert(testCallerScratch(), "testCallerScratch failed");
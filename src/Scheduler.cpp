@@ -0,0 +1,24 @@
+#include "homectl/Scheduler.h"
+
+static_assert(!deadlinePassed(999, 1000), "deadlinePassed failed");
+static_assert(deadlinePassed(1000, 1000), "deadlinePassed failed");
+static_assert(!deadlinePassed(uint32_t(-10), 5), "deadlinePassed failed");
+static_assert(deadlinePassed(5, uint32_t(-10)), "deadlinePassed failed");
+
+void TaskClock::begin() { task_ = xTaskGetCurrentTaskHandle(); }
+
+void TaskClock::sleep(uint32_t ms) {
+  if (ms == 0) return;
+  // Round up, so we don't wake up just before the deadline and spin until it.
+  TickType_t const ticks = ms == UINT32_MAX
+                               ? portMAX_DELAY
+                               : (ms + portTICK_PERIOD_MS - 1) /
+                                     portTICK_PERIOD_MS;
+  ulTaskNotifyTake(pdTRUE, ticks);
+}
+
+void TaskClock::wake() {
+  if (task_ != nullptr) {
+    xTaskNotifyGive(task_);
+  }
+}
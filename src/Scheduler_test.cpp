@@ -0,0 +1,121 @@
+#include "homectl/Scheduler.h"
+
+#include "homectl/unittest.h"
+
+/**
+ * Clock that only moves when the scheduler sleeps, so that a test can run
+ * minutes of schedule in no time.
+ */
+class VirtualClock {
+  uint32_t now_ = 0;
+
+ public:
+  int sleeps = 0;
+  bool sleptForever = false;
+
+  uint32_t now() const { return now_; }
+
+  void sleep(uint32_t ms) {
+    ++sleeps;
+    if (ms == UINT32_MAX) {
+      sleptForever = true;
+      return;
+    }
+    now_ += ms;
+  }
+
+  void wake() {}
+};
+
+using TestScheduler = Scheduler<2, VirtualClock>;
+
+class Recorder {
+ public:
+  VirtualClock const *clock = nullptr;
+  int runs = 0;
+  uint32_t last = 0;
+  /**
+   * Whether all runs were the same time apart.
+   */
+  bool regular = true;
+
+  void run() {
+    uint32_t const now = clock->now();
+    if (runs >= 2 && now - last != interval_) {
+      regular = false;
+    }
+    interval_ = now - last;
+    last = now;
+    ++runs;
+  }
+
+ private:
+  uint32_t interval_ = 0;
+};
+
+TEST(Scheduler, RunsPeriodicTasksOnTime) {
+  TestScheduler scheduler;
+  Recorder fast;
+  Recorder slow;
+  fast.clock = slow.clock = &scheduler.clock();
+  scheduler.every<Recorder, &Recorder::run>(0, fast, 20);
+  scheduler.every<Recorder, &Recorder::run>(1, slow, 6000);
+
+  while (scheduler.clock().now() < 60000) {
+    scheduler.loop();
+  }
+
+  EXPECT_EQ(fast.runs, 3000);
+  EXPECT_EQ(fast.regular, true);
+  EXPECT_EQ(slow.runs, 10);
+  EXPECT_EQ(slow.last, 54000);
+  EXPECT_EQ(slow.regular, true);
+  // Every wake-up had something to do.
+  EXPECT_EQ(scheduler.clock().sleeps, 3000);
+}
+
+TEST(Scheduler, RunsOneShotAndNotifiedTasks) {
+  TestScheduler scheduler;
+  Recorder oneShot;
+  Recorder notified;
+  oneShot.clock = notified.clock = &scheduler.clock();
+  scheduler.on<Recorder, &Recorder::run>(0, oneShot);
+  scheduler.on<Recorder, &Recorder::run>(1, notified);
+
+  // Nothing to do, so it sleeps until notified.
+  scheduler.loop();
+  EXPECT_EQ(scheduler.clock().sleptForever, true);
+
+  scheduler.after(0, 500);
+  scheduler.loop();
+  EXPECT_EQ(scheduler.clock().now(), 500);
+  scheduler.loop();
+  EXPECT_EQ(oneShot.runs, 1);
+  EXPECT_EQ(oneShot.last, 500);
+
+  // A notification runs the task right away, even with a deadline pending.
+  scheduler.after(0, 1000);
+  scheduler.notify(1);
+  EXPECT_EQ(scheduler.runDue(), 1000);
+  EXPECT_EQ(notified.runs, 1);
+  EXPECT_EQ(notified.last, 500);
+
+  // Cancelled deadlines don't run.
+  scheduler.cancel(0);
+  EXPECT_EQ(scheduler.runDue() == TestScheduler::FOREVER, true);
+  EXPECT_EQ(oneShot.runs, 1);
+}
+
+TEST(Scheduler, SkipsMissedPeriods) {
+  Scheduler<1, VirtualClock> scheduler;
+  Recorder task;
+  task.clock = &scheduler.clock();
+  scheduler.every<Recorder, &Recorder::run>(0, task, 100);
+
+  EXPECT_EQ(scheduler.runDue(), 100);
+  // Something held up the loop for 3.5 periods.
+  scheduler.clock().sleep(350);
+  EXPECT_EQ(scheduler.runDue(), 100);
+  EXPECT_EQ(task.runs, 2);
+  EXPECT_EQ(task.last, 350);
+}
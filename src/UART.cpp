@@ -1,41 +1,103 @@
 #include "homectl/UART.h"
 
-#include "homectl/Logger.h"
+#include "homectl/Print.h"
 
-static bool hasGarbage(Stream &io, byte startByte) {
-  return io.available() > 0 && (byte)io.peek() != startByte;
+Print &operator<<(Print &out, FrameErrors const &errors) {
+  out << errors.syncLosses << F(" sync losses, ") << errors.lengthErrors
+      << F(" length errors, ") << errors.checksumFailures
+      << F(" checksum failures");
+  return out;
 }
 
-int readResponse(Stream &io, byte *response, size_t recvSize, byte startByte) {
-  int waited = 0;
-  while (io.available() == 0) {
-    delay(100);  // wait a short moment to avoid false reading
-    if (waited++ > 10) {
-      LOG(F("no response after 1 second"));
-      io.flush();
-      return STATUS_NO_RESPONSE;
-    }
+void UartPort::begin(unsigned long baud, int rxPin, int txPin) {
+  uart_config_t config = {};
+  config.baud_rate = baud;
+  config.data_bits = UART_DATA_8_BITS;
+  config.parity = UART_PARITY_DISABLE;
+  config.stop_bits = UART_STOP_BITS_1;
+  config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  uart_param_config(port_, &config);
+  uart_set_pin(port_, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+  uart_driver_install(port_, RX_BUFFER_SIZE, 0, EVENT_QUEUE_SIZE, &events_, 0);
+
+  // The task only moves flags around, and calls received(), which should do no
+  // more than wake up another task.
+  constexpr uint32_t STACK_SIZE = 1536;
+
+  xTaskCreatePinnedToCore(waitForEvents, /* Function to implement the task */
+                          "UART",        /* Name of the task */
+                          STACK_SIZE,    /* Stack size in bytes */
+                          this,          /* Task input parameter */
+                          1,             /* Priority of the task */
+                          &task_,        /* Task handle. */
+                          1);            /* Core where the task should run */
+}
+
+UartPort::~UartPort() {
+  if (task_ != nullptr) {
+    vTaskDelete(task_);
   }
+  if (events_ != nullptr) {
+    uart_driver_delete(port_);
+  }
+}
 
-  // The response starts with 0xff. If we get anything else, it's garbage.
-  if (hasGarbage(io, startByte)) {
-    auto logger = LOG(F("skipping unexpected readings:"));
-    while (hasGarbage(io, startByte)) {
-      logger.printf(" %02X", io.read());
+void UartPort::waitForEvents(void *self) {
+  UartPort &port = *static_cast<UartPort *>(self);
+  uart_event_t event;
+  while (true) {
+    if (xQueueReceive(port.events_, &event, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    switch (event.type) {
+      case UART_DATA:
+        break;
+      case UART_FIFO_OVF:
+      case UART_BUFFER_FULL:
+        // Bytes were lost, but whatever made it is still worth parsing.
+        port.overflows_.fetch_add(1, std::memory_order_relaxed);
+        break;
+      default:
+        continue;
     }
+    port.rxEvent_.store(true, std::memory_order_release);
+    port.received();
   }
+}
 
-  if (io.available() > 0) {
-    int const count = io.readBytes(response, recvSize);
-    if (count < recvSize) {
-      io.flush();
-      return STATUS_INCOMPLETE;
-    }
-  } else {
-    io.flush();
-    return STATUS_INCOMPLETE;
+bool UartPort::takeRxEvent() {
+  return rxEvent_.exchange(false, std::memory_order_acquire);
+}
+
+int UartPort::available() {
+  size_t size = 0;
+  uart_get_buffered_data_len(port_, &size);
+  return size + (peeked_ >= 0);
+}
+
+int UartPort::read() {
+  if (peeked_ >= 0) {
+    int const b = peeked_;
+    peeked_ = -1;
+    return b;
+  }
+  uint8_t b;
+  return uart_read_bytes(port_, &b, 1, 0) == 1 ? b : -1;
+}
+
+int UartPort::peek() {
+  if (peeked_ < 0) {
+    peeked_ = read();
   }
+  return peeked_;
+}
+
+void UartPort::flush() { uart_wait_tx_done(port_, portMAX_DELAY); }
+
+size_t UartPort::write(uint8_t b) { return write(&b, 1); }
 
-  LOG(F("  <<"), Bytes(response, recvSize));
-  return 0;
+size_t UartPort::write(uint8_t const *buffer, size_t size) {
+  int const written =
+      uart_write_bytes(port_, reinterpret_cast<char const *>(buffer), size);
+  return written < 0 ? 0 : written;
 }
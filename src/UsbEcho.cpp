@@ -4,6 +4,8 @@
 
 #include "homectl/Logger.h"
 
+LOG_MODULE(HOMECTL);
+
 static bool isLineBreak(char c) { return c == '\r' || c == '\n'; }
 
 static void skipLineBreaks(Stream &in) {
@@ -15,8 +17,8 @@ static void skipLineBreaks(Stream &in) {
 void UsbEcho::loop() {
   char const *const et = recv_ + sizeof recv_;
 
-  // Read the incoming byte, if there is one.
-  if (Serial.available() > 0) {
+  // Read whatever came in since the last call.
+  while (Serial.available() > 0) {
     *it_ = Serial.read();
     if (isLineBreak(*it_) || it_ + 1 == et) {
       skipLineBreaks(Serial);
@@ -2,8 +2,39 @@
 
 #include <Arduino.h>
 
+#include <atomic>
+
 UnitTest const *UnitTest::registry_;
 
+static std::atomic<uint32_t> allocationCount{0};
+
+#ifdef COUNT_ALLOCATIONS
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __real_realloc(ptr, size);
+}
+}
+#endif
+
+uint32_t UnitTest::allocations() {
+  return allocationCount.load(std::memory_order_relaxed);
+}
+
 UnitTest::UnitTest() : next_(registry_) { registry_ = this; }
 
 void UnitTest::run() {